@@ -4,13 +4,16 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../usb/host/class/usb_host_cdc.c 
+../usb/host/class/usb_host_cdc.c \
+../usb/host/class/usb_host_midi.c 
 
 OBJS += \
-./usb/host/class/usb_host_cdc.o 
+./usb/host/class/usb_host_cdc.o \
+./usb/host/class/usb_host_midi.o 
 
 C_DEPS += \
-./usb/host/class/usb_host_cdc.d 
+./usb/host/class/usb_host_cdc.d \
+./usb/host/class/usb_host_midi.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
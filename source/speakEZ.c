@@ -54,19 +54,16 @@
  * GLOBAL VARIABLE DEFINITIONS:
  * * * * * * * * * * * * * * * * * * * * * * */
 
-/*! @brief SAI IRQ done flag to trigger audio updates */
-volatile _Bool SAI_RequestSynthUpdate = 0;
-
 /*! @brief SW4 debouncing global variables for PIT interrupt */
 volatile uint32_t g_sw4Debounce = 0;
 volatile _Bool g_sw4Pressed = 0;
 
 /*! @brief USB MIDI global variables */
 usb_host_handle g_demoUSBHostHandle;
-usb_host_cdc_instance_struct_t g_demoMidiInstance;
-usbmidi_event_packet_t g_demoMidiEventPacket;
-usb_host_pipe_init_t g_demoMidiEventPipeInit;
-volatile _Bool g_demoMidiPacketRecvFlag = 0;
+usbmidi_host_instance_t g_demoMidiInstance;
+uint32_t g_demoMidiEventPackets[MIDI_EVENT_QUEUE_SIZE];
+uint32_t g_demoMidiEventTimes[MIDI_EVENT_QUEUE_SIZE];
+usb_host_midi_packet_ring_t g_demoMidiEventQueue;
 
 
 
@@ -394,36 +391,123 @@ void configureWM8960() {
 
 
 /*
- * setTxAudio
+ * initAudioDma
+ *
+ * Replaces the per-frame SAI1 interrupt with two circular eDMA channels.
+ * Rx fills SAI1_rxDmaBuffer and Tx drains SAI1_txDmaBuffer, one frame
+ * per SAI FIFO request, wrapping back to the start after two blocks.
  *
- * Thread-safe audio Tx copy after program calculations.
+ * Only the Rx channel interrupts, at the half and full points of its
+ * major loop. Rx and Tx run in lockstep off the same frame clock,
+ * so when an Rx half completes, the Tx channel is busy playing the other
+ * half and the matching Tx half is free to be refilled.
+ *
+ * Must be called after BOARD_InitBootPeripherals and before the
+ * SAI transmitter and receiver are enabled.
+ */
+void initAudioDma(void) {
+
+	edma_config_t dmaConfig;
+	edma_transfer_config_t transferConfig;
+
+	/* Prime the output with silence; this is the slack the program loop gets */
+	g_txAudioFifo.head = kAudio_Fifo_Blocks / 2;
+
+	/* The DMA takes over from the FIFO request interrupt set up by the config tools */
+	SAI_TxDisableInterrupts(SAI_1_PERIPHERAL, kSAI_FIFOWarningInterruptEnable | kSAI_FIFORequestInterruptEnable);
+	DisableIRQ(SAI_1_IRQN);
+
+	DMAMUX_Init(DMAMUX);
+	DMAMUX_SetSource(DMAMUX, SAI1_RX_DMA_CHANNEL, kDmaRequestMuxSai1Rx);
+	DMAMUX_SetSource(DMAMUX, SAI1_TX_DMA_CHANNEL, kDmaRequestMuxSai1Tx);
+	DMAMUX_EnableChannel(DMAMUX, SAI1_RX_DMA_CHANNEL);
+	DMAMUX_EnableChannel(DMAMUX, SAI1_TX_DMA_CHANNEL);
+
+	EDMA_GetDefaultConfig(&dmaConfig);
+	EDMA_Init(DMA0, &dmaConfig);
+
+	/* Rx: SAI1 RDR0 -> SAI1_rxDmaBuffer, one frame per request */
+	EDMA_CreateHandle(&g_SAI1_rxDmaHandle, DMA0, SAI1_RX_DMA_CHANNEL);
+	EDMA_SetCallback(&g_SAI1_rxDmaHandle, SAI1_RxDmaCallback, NULL);
+	EDMA_PrepareTransfer(&transferConfig,
+			(void *)(uintptr_t)SAI_RxGetDataRegisterAddress(SAI_1_PERIPHERAL, 0), sizeof(int32_t),
+			SAI1_rxDmaBuffer, sizeof(int32_t),
+			kAudio_Buffer_Words * sizeof(int32_t), sizeof(SAI1_rxDmaBuffer),
+			kEDMA_PeripheralToMemory);
+	EDMA_SetTransferConfig(DMA0, SAI1_RX_DMA_CHANNEL, &transferConfig, NULL);
+	DMA0->TCD[SAI1_RX_DMA_CHANNEL].DLAST_SGA = (uint32_t)(-(int32_t)sizeof(SAI1_rxDmaBuffer)); // wrap to start
+	EDMA_EnableChannelInterrupts(DMA0, SAI1_RX_DMA_CHANNEL, kEDMA_HalfInterruptEnable | kEDMA_MajorInterruptEnable);
+	NVIC_SetPriority(SAI1_RX_DMA_IRQN, SAI_1_IRQ_PRIORITY);
+
+	/* Tx: SAI1_txDmaBuffer -> SAI1 TDR0, one frame per request, no interrupts */
+	EDMA_ResetChannel(DMA0, SAI1_TX_DMA_CHANNEL);
+	EDMA_PrepareTransfer(&transferConfig,
+			SAI1_txDmaBuffer, sizeof(int32_t),
+			(void *)(uintptr_t)SAI_TxGetDataRegisterAddress(SAI_1_PERIPHERAL, 0), sizeof(int32_t),
+			kAudio_Buffer_Words * sizeof(int32_t), sizeof(SAI1_txDmaBuffer),
+			kEDMA_MemoryToPeripheral);
+	EDMA_SetTransferConfig(DMA0, SAI1_TX_DMA_CHANNEL, &transferConfig, NULL);
+	DMA0->TCD[SAI1_TX_DMA_CHANNEL].SLAST = -(int32_t)sizeof(SAI1_txDmaBuffer); // wrap to start
+	EDMA_EnableAutoStopRequest(DMA0, SAI1_TX_DMA_CHANNEL, false); // the reset left DREQ set; keep requests on past each major loop
+
+	EDMA_EnableChannelRequest(DMA0, SAI1_TX_DMA_CHANNEL);
+	EDMA_EnableChannelRequest(DMA0, SAI1_RX_DMA_CHANNEL);
+
+	SAI_TxEnableDMA(SAI_1_PERIPHERAL, kSAI_FIFORequestDMAEnable, true);
+	SAI_RxEnableDMA(SAI_1_PERIPHERAL, kSAI_FIFORequestDMAEnable, true);
+}
+/*
+ * audioFifoWriteSlot
  *
- * The input argument should be "outputAudioBuffer".
+ * Producer side. Returns the next free block of the FIFO to fill,
+ * or NULL if the FIFO is full.
  */
-void setTxAudio(int32_t *audioBuffer) {
-	NVIC_DisableIRQ(SAI1_IRQn);
+int32_t *audioFifoWriteSlot(audioFifo *fifo) {
 
-	for(int ii = 0; ii < kAudio_Buffer_Words; ii++) {
-		SAI1_txAudio[ii] = audioBuffer[ii] * 256; // sign-agnostic left-shift
-	}
+	uint32_t head = fifo->head;
+
+	if(head - fifo->tail >= kAudio_Fifo_Blocks) return NULL;
 
-	NVIC_EnableIRQ(SAI1_IRQn);
+	return fifo->block[head & (kAudio_Fifo_Blocks - 1)];
 }
 /*
- * getRxAudio
+ * audioFifoPublish
  *
- * Thread-safe audio Rx copy for further manipulation.
+ * Producer side. Hands the block filled after audioFifoWriteSlot
+ * to the consumer. The barrier keeps the block data ahead of the index.
+ */
+void audioFifoPublish(audioFifo *fifo) {
+
+	__DMB();
+	fifo->head = fifo->head + 1;
+
+}
+/*
+ * audioFifoReadSlot
  *
- * The input argument should be "inputAudioBuffer".
+ * Consumer side. Returns the oldest published block of the FIFO,
+ * or NULL if the FIFO is empty.
  */
-void getRxAudio(int32_t *audioBuffer) {
-	NVIC_DisableIRQ(SAI1_IRQn);
+int32_t *audioFifoReadSlot(audioFifo *fifo) {
 
-	for(int ii = 0; ii < kAudio_Buffer_Words; ii++) {
-		audioBuffer[ii] = SAI1_rxAudio[ii] / 256; // sign-agnostic right-shift
-	}
+	uint32_t tail = fifo->tail;
+
+	if(fifo->head == tail) return NULL;
+	__DMB(); // don't read block data from before the index was published
+
+	return fifo->block[tail & (kAudio_Fifo_Blocks - 1)];
+}
+/*
+ * audioFifoRelease
+ *
+ * Consumer side. Returns the block read after audioFifoReadSlot
+ * to the producer. The barrier keeps our reads ahead of the index.
+ */
+void audioFifoRelease(audioFifo *fifo) {
+
+	__DMB();
+	fifo->tail = fifo->tail + 1;
 
-	NVIC_EnableIRQ(SAI1_IRQn);
 }
 
 
@@ -483,10 +567,99 @@ void setWavetableNovel(int32_t *inputWavetable, uint32_t tableLen) {
 			inputWavetable[i] = (int32_t)kSynth_Min_Audio_Level;
 		}
 		else {
-			inputWavetable[i] = (int32_t)( (4.0 * ( i / tableLen - 0.5)) * kSynth_Max_Audio_Level + kSynth_Min_Audio_Level );
+			inputWavetable[i] = (int32_t)( (4.0 * ( (double)i / tableLen - 0.5)) * kSynth_Max_Audio_Level + kSynth_Min_Audio_Level );
+		}
+
+	}
+}
+/*
+ * buildWavetableMipmap
+ *
+ * Fills numLevels band-limited copies of naiveTable, one per octave,
+ * by taking its spectrum and inverse transforming it with the partials
+ * above each level's limit removed. Levels past numLevels reuse the
+ * last one built.
+ *
+ * Every level is played back with the same SYNTH_MIP_SCALE, so they
+ * must share one scale too, or loudness would jump where keys cross
+ * from one level to the next. A first pass finds the largest peak of
+ * any level, and if that would overflow the int16 table the whole
+ * mipmap is scaled down to fit, rather than clipped, since clipping
+ * puts back the very harmonics the levels were built without.
+ *
+ * Runs once at boot; the FFT scratch is too slow to call from the audio path.
+ */
+void buildWavetableMipmap(wavetableMipmap *mipmap, int16_t (*levels)[kSynth_Table_Length], uint32_t numLevels, const int32_t *naiveTable) {
+
+	arm_rfft_fast_instance_f32 fft;
+	float peak = 0.0f;
+	float scale = 1.0f / SYNTH_MIP_SCALE;
+
+	assert(numLevels >= 1 && numLevels <= kSynth_Mip_Levels);
+
+	arm_rfft_fast_init_f32(&fft, kSynth_Table_Length);
+
+	for(uint32_t pass = 0; pass < 2; pass++) {
+
+		uint32_t maxHarmonic = kSynth_Table_Length / 2;
+
+		for(uint32_t n = 0; n < kSynth_Table_Length; n++) {
+			wavetableFftIn[n] = (float)naiveTable[n];
+		}
+		arm_rfft_fast_f32(&fft, wavetableFftIn, wavetableFftSpectrum, 0);
+
+		/*
+		 * The packed spectrum keeps DC in [0], Nyquist in [1], and
+		 * harmonic k as (re, im) in [2k], [2k+1]. Nyquist is never kept.
+		 */
+		wavetableFftSpectrum[1] = 0.0f;
+
+		for(uint32_t level = 0; level < numLevels; level++) {
+
+			uint32_t keepHarmonics = (kSynth_Table_Length / 2) >> level;
+
+			for(uint32_t k = keepHarmonics; k < maxHarmonic; k++) {
+				wavetableFftSpectrum[2*k] = 0.0f;
+				wavetableFftSpectrum[2*k + 1] = 0.0f;
+			}
+			maxHarmonic = keepHarmonics;
+
+			// The inverse transform scribbles over its input, so feed it a copy
+			arm_copy_f32(wavetableFftSpectrum, wavetableFftIn, kSynth_Table_Length);
+			arm_rfft_fast_f32(&fft, wavetableFftIn, wavetableFftOut, 1);
+
+			for(uint32_t n = 0; n < kSynth_Table_Length; n++) {
+				if(pass == 0) {
+					if(fabsf(wavetableFftOut[n]) > peak) peak = fabsf(wavetableFftOut[n]);
+				}
+				else {
+					levels[level][n] = (int16_t)roundf(wavetableFftOut[n] * scale);
+				}
+			}
 		}
 
+		if(pass == 0 && peak * scale > kSynth_Mip_Full_Scale) scale = kSynth_Mip_Full_Scale / peak;
+	}
+
+	for(uint32_t level = 0; level < kSynth_Mip_Levels; level++) {
+		mipmap->level[level] = levels[(level < numLevels) ? level : numLevels - 1];
+	}
+}
+/*
+ * mipLevelForIncrement
+ *
+ * Returns the lowest (brightest) mip level whose partials all stay
+ * below Nyquist at the given phase increment, in table samples per frame.
+ */
+uint8_t mipLevelForIncrement(float phaseIncrement) {
+
+	uint8_t level = 0;
+
+	while(level < kSynth_Mip_Levels - 1 && phaseIncrement > (float)(1U << level)) {
+		level++;
 	}
+
+	return level;
 }
 
 
@@ -494,6 +667,7 @@ void setWavetableNovel(int32_t *inputWavetable, uint32_t tableLen) {
  * initSynth
  *
  * Sets the values of freq and phaseIncrement for a wavetable synth,
+ * picks the band-limited table level each key plays from,
  * and initializes the keyActive status and phase of all keys to 0.
  * Sets the channel number and initial pitchbends.
  *
@@ -503,98 +677,382 @@ void initSynth(wavetableSynth *synth, uint32_t numKeys, uint32_t indexA3, float
 
 	assert(indexA3 <= numKeys);
 
-	int i;
+	uint32_t i;
+
+	// Leave room for a full bend up, so the chosen level never aliases mid-note
+	float bendHeadroom = powf(TWELFTH_ROOT_OF_TWO, (float)kSynth_Pbend_Semitones);
 
 	for(i = 0; i < indexA3; ++i) {
 		synth->freq[i] = freqA3 / powf(TWELFTH_ROOT_OF_TWO, (float)(indexA3 - i));
 		synth->phaseIncrement[i] = kSynth_Table_Length * synth->freq[i] / kAudio_Frame_Hz;
 		synth->phase[i] = 0;
 		synth->velocity[i] = 0;
+		synth->noteOnStamp[i] = 0;
+		synth->gain[i] = 0;
+		synth->phaseStep[i] = 0;
+		synth->phaseStepNow[i] = 0;
+		synth->mipLevel[i] = mipLevelForIncrement(synth->phaseIncrement[i] * bendHeadroom);
 	}
 	for(; i < numKeys; ++i) {
 		synth->freq[i] = freqA3 * powf(TWELFTH_ROOT_OF_TWO, (float)(i - indexA3));
 		synth->phaseIncrement[i] = kSynth_Table_Length * synth->freq[i] / kAudio_Frame_Hz;
 		synth->phase[i] = 0;
 		synth->velocity[i] = 0;
+		synth->noteOnStamp[i] = 0;
+		synth->gain[i] = 0;
+		synth->phaseStep[i] = 0;
+		synth->phaseStepNow[i] = 0;
+		synth->mipLevel[i] = mipLevelForIncrement(synth->phaseIncrement[i] * bendHeadroom);
 	}
 
 	synth->midiChannel = chNum;
 	synth->pbendFactor = 1.0;
+	synth->numActive = 0;
+	synth->numFading = 0;
+	synth->noteOnCount = 0;
+	synth->voiceSteal = kSynth_Steal_Oldest;
+	synth->velocityCurve = kSynth_Velocity_Linear;
+
+	setVelocityTableSoft(velocityCurveTable);
 
 }
 /*
- * playSynth
+ * playSynthBlock
  *
- * Outputs a wavetable audio sample using the active notes and their phases
- * for the specified synth. Increments the note phases.
+ * Renders a block of wavetable audio samples using the active notes and
+ * their phases for the specified synth, one key at a time, so each
+ * key's phase stays in a register across the block. Increments the
+ * note phases.
  *
- * Returns a signed value fenced within 24 significant bits.
+ * Only keys in the active list are visited, so the cost scales with
+ * the number of sounding notes rather than the size of the keyboard.
+ *
+ * Each key's increment ramps linearly from where the last block left it
+ * to its cached bent increment, so pitch-bend moves don't zipper.
+ *
+ * Each key reads the mip level chosen for its pitch in initSynth, so
+ * high notes play from tables with their upper partials already removed.
+ *
+ * Voices stolen from the pool are played on to the end of their fade
+ * (see stealVoice).
+ *
+ * Writes signed values fenced within 24 significant bits.
  */
-int32_t playSynth(wavetableSynth *synth) {
+void playSynthBlock(wavetableSynth *synth, int32_t *audioOut, uint32_t frames) {
+
+	float mix[kAudio_Block_Frames] = {0};
+
+	assert(frames <= kAudio_Block_Frames);
+
+	for(uint32_t v = 0; v < synth->numActive; v++) {
+		uint32_t i = synth->activeKeys[v];
+		renderVoice(synth, i, mix, frames, synth->gain[i], 0.0f);
+	}
+
+	/* Stolen voices fade out, and leave the list once they reach silence */
+	uint32_t stillFading = 0;
 
-	int32_t audioOut = 0;
-	uint32_t startIndex = 0;
-	float interpDist = 0;
-	float interpBegin = 0;
-	float interpEnd = 0;
+	for(uint32_t f = 0; f < synth->numFading; f++) {
 
-	for(int i = 0; i < kSynth_Num_Keys; i++) {
+		uint32_t fadeFrames = synth->fadeFrames[f];
+		uint32_t run = (fadeFrames < frames) ? fadeFrames : frames;
 
-		if(synth->velocity[i] == 0) continue;
+		renderVoice(synth, synth->fadingKeys[f], mix, run, synth->fadeStep[f] * fadeFrames, -synth->fadeStep[f]);
+
+		if(fadeFrames > run) {
+			synth->fadingKeys[stillFading] = synth->fadingKeys[f];
+			synth->fadeFrames[stillFading] = fadeFrames - run;
+			synth->fadeStep[stillFading] = synth->fadeStep[f];
+			stillFading++;
+		}
+	}
+	synth->numFading = stillFading;
+
+	for(uint32_t n = 0; n < frames; n++) {
+		if(mix[n] > kSynth_Max_Audio_Level) mix[n] = kSynth_Max_Audio_Level;
+		if(mix[n] < kSynth_Min_Audio_Level) mix[n] = kSynth_Min_Audio_Level;
+		audioOut[n] = (int32_t)mix[n];
+	}
+}
+/*
+ * renderVoice
+ *
+ * Adds frames of the specified key's wavetable into mix, starting at
+ * gain and moving by gainStep each frame, and advances its phase.
+ */
+void renderVoice(wavetableSynth *synth, uint32_t keyIndex, float *mix, uint32_t frames, float gain, float gainStep) {
+
+	uint32_t i = keyIndex;
+	const int16_t *table = synth->wavetable->level[synth->mipLevel[i]];
+
+	gain *= SYNTH_MIP_SCALE;
+	gainStep *= SYNTH_MIP_SCALE;
+
+#if SYNTH_FIXED_POINT_PHASE
+	/*
+	 * The top bits of the 32-bit phase index the table and the rest
+	 * are the interpolation fraction; the table wraps for free on overflow.
+	 */
+	uint32_t phase = synth->phase[i];
+	uint32_t increment = synth->phaseStepNow[i];
+	int32_t incrementRamp = (int32_t)(synth->phaseStep[i] - increment) / (int32_t)frames;
+
+	for(uint32_t n = 0; n < frames; n++) {
+
+		uint32_t startIndex = phase >> SYNTH_PHASE_FRAC_BITS;
+		float interpDist = (float)(phase & SYNTH_PHASE_FRAC_MASK) * (1.0f / (float)(1U << SYNTH_PHASE_FRAC_BITS));
+		float interpBegin = (float)table[startIndex];
+		float interpEnd = (float)table[(startIndex + 1) & (kSynth_Table_Length - 1)];
+
+		mix[n] += gain * (interpBegin + interpDist * (interpEnd - interpBegin));
+
+		gain += gainStep;
+		increment += incrementRamp;
+		phase += increment;
+	}
+#else
+	float phase = synth->phase[i];
+	float increment = synth->phaseStepNow[i];
+	float incrementRamp = (synth->phaseStep[i] - increment) / frames;
+
+	for(uint32_t n = 0; n < frames; n++) {
 
 		/*
 		 * We must perform a linear interpolation to extract an approximate
 		 * waveform amplitude for fractional indices
 		 */
-		startIndex = (uint32_t)synth->phase[i];
-		interpDist = synth->phase[i] - startIndex;
-		interpBegin = (float)synth->wavetable[startIndex] * synth->velocity[i] / kSynth_Max_Velocity;
-		interpEnd = (float)synth->wavetable[(startIndex + 1) % kSynth_Table_Length] * synth->velocity[i] / kSynth_Max_Velocity;
-
-		audioOut += (int32_t)( interpBegin + interpDist * (interpEnd - interpBegin) );
-
-		if(audioOut > kSynth_Max_Audio_Level) audioOut = kSynth_Max_Audio_Level;
-		if(audioOut < kSynth_Min_Audio_Level) audioOut = kSynth_Min_Audio_Level;
-
-		synth->phase[i] += synth->phaseIncrement[i] * synth->pbendFactor;
-		if(synth->phase[i] >= kSynth_Table_Length) {
-			synth->phase[i] = synth->phase[i] - kSynth_Table_Length;
+		uint32_t startIndex = (uint32_t)phase;
+		float interpDist = phase - startIndex;
+		float interpBegin = (float)table[startIndex];
+		float interpEnd = (float)table[(startIndex + 1) % kSynth_Table_Length];
+
+		mix[n] += gain * (interpBegin + interpDist * (interpEnd - interpBegin));
+
+		gain += gainStep;
+		increment += incrementRamp;
+		phase += increment;
+		if(phase >= kSynth_Table_Length) {
+			phase = phase - kSynth_Table_Length;
 		}
 	}
+#endif
+
+	synth->phase[i] = phase;
+	synth->phaseStepNow[i] = synth->phaseStep[i];
+}
+/*
+ * playSynth
+ *
+ * Single-sample wrapper for playSynthBlock.
+ *
+ * Returns a signed value fenced within 24 significant bits.
+ */
+int32_t playSynth(wavetableSynth *synth) {
+
+	int32_t audioOut;
+	playSynthBlock(synth, &audioOut, 1);
 
 	return audioOut;
 }
 /*
  * pressKey
  *
- * Sets the specified key index to the desired velocity for the wavetableSynth
+ * Sets the specified key index to the desired velocity for the wavetableSynth,
+ * and maps the velocity to the key's gain through the synth's velocity curve.
+ * A newly sounding key takes a slot in the voice pool; if the pool is
+ * full, the synth's voiceSteal policy decides whether a voice is
+ * stolen for it or the note is dropped. A key pressed again while
+ * sounding keeps its phase and only takes the new velocity, so repeated
+ * notes don't click. A velocity of 0
+ * releases the key, as MIDI allows for Note On.
  */
 void pressKey(wavetableSynth *synth, uint32_t keyIndex, uint32_t keyVelocity) {
 
 	if(keyVelocity > kSynth_Max_Velocity) keyVelocity = kSynth_Max_Velocity;
 
 	if(keyIndex < kSynth_Num_Keys) {
+
+		if(keyVelocity == 0) {
+			releaseKey(synth, keyIndex);
+			return;
+		}
+
+		if(synth->velocity[keyIndex] == 0) {
+
+			if(synth->numActive >= SYNTH_MAX_VOICES) {
+				if(synth->voiceSteal == kSynth_Steal_Same_Note) return;
+				stealVoice(synth, findStealVictim(synth));
+			}
+
+			// A key caught fading picks up from where its fade had reached
+			cancelFade(synth, keyIndex);
+
+			synth->activeSlot[keyIndex] = synth->numActive;
+			synth->activeKeys[synth->numActive++] = keyIndex;
+
+			synth->phaseStep[keyIndex] = bentPhaseStep(synth, keyIndex);
+			synth->phaseStepNow[keyIndex] = synth->phaseStep[keyIndex];
+		}
+		synth->noteOnStamp[keyIndex] = synth->noteOnCount++;
 		synth->velocity[keyIndex] = keyVelocity;
+		synth->gain[keyIndex] = velocityToGain(synth->velocityCurve, keyVelocity);
 	}
 
 }
+/*
+ * velocityToGain
+ *
+ * Maps a MIDI velocity (0 to kSynth_Max_Velocity) to a linear amplitude
+ * gain (0 to 1) using the selected curve. Only called at note-on.
+ *
+ * kSynth_Velocity_Exponential spans SYNTH_VELOCITY_EXP_RANGE_DB of
+ * dynamic range, which most players find more natural than linear.
+ * kSynth_Velocity_Table looks the gain up in velocityCurveTable,
+ * which can be filled with any curve you like.
+ */
+float velocityToGain(velocity_curve_t curve, uint32_t keyVelocity) {
+
+	if(keyVelocity == 0) return 0;
+	if(keyVelocity > kSynth_Max_Velocity) keyVelocity = kSynth_Max_Velocity;
+
+	switch(curve) {
+
+	case kSynth_Velocity_Exponential:
+		return powf(10.0f, SYNTH_VELOCITY_EXP_RANGE_DB *
+				((float)keyVelocity / kSynth_Max_Velocity - 1.0f) / 20.0f);
+
+	case kSynth_Velocity_Table:
+		return velocityCurveTable[keyVelocity];
+
+	case kSynth_Velocity_Linear:
+	default:
+		return (float)keyVelocity / kSynth_Max_Velocity;
+	}
+}
+/*
+ * setVelocityTableSoft
+ *
+ * Initializes a velocity curve table with a square-root curve,
+ * which favors soft playing: half velocity gives about 70% gain.
+ */
+void setVelocityTableSoft(float *table) {
+	for(uint32_t i = 0; i <= kSynth_Max_Velocity; i++) {
+		table[i] = sqrtf((float)i / kSynth_Max_Velocity);
+	}
+}
 /*
  * releaseKey
  *
  * Resets the specified key index for the wavetableSynth so it is no longer active.
+ * The last entry of the active list is moved into the freed slot.
  * Keys have memory, so they retain the phase they left off on.
  */
 void releaseKey(wavetableSynth *synth, uint32_t keyIndex) {
 
 	if(keyIndex < kSynth_Num_Keys) {
+
+		if(synth->velocity[keyIndex] == 0) return;
+
+		uint32_t slot = synth->activeSlot[keyIndex];
+		uint32_t lastKey = synth->activeKeys[--synth->numActive];
+
+		synth->activeKeys[slot] = lastKey;
+		synth->activeSlot[lastKey] = slot;
+
 		synth->velocity[keyIndex] = 0;
 	}
 
+}
+/*
+ * findStealVictim
+ *
+ * Returns the sounding key a new note should take the voice from,
+ * per the synth's voiceSteal policy. Only called with a full pool.
+ */
+uint32_t findStealVictim(wavetableSynth *synth) {
+
+	uint32_t victim = synth->activeKeys[0];
+
+	for(uint32_t v = 1; v < synth->numActive; v++) {
+
+		uint32_t i = synth->activeKeys[v];
+
+		if(synth->voiceSteal == kSynth_Steal_Quietest) {
+			if(synth->gain[i] < synth->gain[victim]) victim = i;
+		}
+		else {
+			// Ages are taken relative to the counter, so it may wrap freely
+			if(synth->noteOnCount - synth->noteOnStamp[i] > synth->noteOnCount - synth->noteOnStamp[victim]) victim = i;
+		}
+	}
+
+	return victim;
+}
+/*
+ * stealVoice
+ *
+ * Takes the specified sounding key out of the voice pool for a new
+ * note, and fades it out from its gain over kSynth_Steal_Fade_Frames.
+ * If SYNTH_MAX_FADING keys are already fading, the oldest is cut short.
+ */
+void stealVoice(wavetableSynth *synth, uint32_t keyIndex) {
+
+	float gain = synth->gain[keyIndex];
+
+	releaseKey(synth, keyIndex);
+
+	if(synth->numFading >= SYNTH_MAX_FADING) {
+		for(uint32_t f = 1; f < synth->numFading; f++) {
+			synth->fadingKeys[f - 1] = synth->fadingKeys[f];
+			synth->fadeFrames[f - 1] = synth->fadeFrames[f];
+			synth->fadeStep[f - 1] = synth->fadeStep[f];
+		}
+		synth->numFading--;
+	}
+
+	uint32_t f = synth->numFading++;
+	synth->fadingKeys[f] = keyIndex;
+	synth->fadeFrames[f] = kSynth_Steal_Fade_Frames;
+	synth->fadeStep[f] = gain / kSynth_Steal_Fade_Frames;
+}
+/*
+ * cancelFade
+ *
+ * Stops the specified key fading, if it is, keeping the order of the rest.
+ */
+void cancelFade(wavetableSynth *synth, uint32_t keyIndex) {
+
+	uint32_t kept = 0;
+
+	for(uint32_t f = 0; f < synth->numFading; f++) {
+		if(synth->fadingKeys[f] == keyIndex) continue;
+		synth->fadingKeys[kept] = synth->fadingKeys[f];
+		synth->fadeFrames[kept] = synth->fadeFrames[f];
+		synth->fadeStep[kept] = synth->fadeStep[f];
+		kept++;
+	}
+	synth->numFading = kept;
+}
+/*
+ * bentPhaseStep
+ *
+ * Returns the phase increment of the specified key with the synth's
+ * current pitchbend applied, in the oscillator's phase format.
+ */
+synth_phase_t bentPhaseStep(wavetableSynth *synth, uint32_t keyIndex) {
+
+#if SYNTH_FIXED_POINT_PHASE
+	return (uint32_t)(synth->phaseIncrement[keyIndex] * synth->pbendFactor * (float)(1U << SYNTH_PHASE_FRAC_BITS));
+#else
+	return synth->phaseIncrement[keyIndex] * synth->pbendFactor;
+#endif
 }
 /*
  * updatePitchbend
  *
- * Updates the pbendFactor for the specified synth
+ * Updates the pbendFactor for the specified synth, and recomputes
+ * the cached bent increments of the sounding and fading keys. Silent
+ * keys get theirs when they are pressed.
  */
 void updatePitchbend(wavetableSynth *synth, uint32_t pbLSB, uint32_t pbMSB) {
 
@@ -604,6 +1062,15 @@ void updatePitchbend(wavetableSynth *synth, uint32_t pbLSB, uint32_t pbMSB) {
 
 	synth->pbendFactor = powf(2.0f, scaledPbVal * (float)kSynth_Pbend_Semitones / 12.0f);
 
+	for(uint32_t v = 0; v < synth->numActive; v++) {
+		uint32_t i = synth->activeKeys[v];
+		synth->phaseStep[i] = bentPhaseStep(synth, i);
+	}
+	for(uint32_t f = 0; f < synth->numFading; f++) {
+		uint32_t i = synth->fadingKeys[f];
+		synth->phaseStep[i] = bentPhaseStep(synth, i);
+	}
+
 }
 
 /*
@@ -619,19 +1086,19 @@ void toggleActiveWavetable(wavetableSynth *synth) {
 	switch(g_activeWavetable) {
 
 	case kSynth_Wavetable_Sine:
-		synth->wavetable = &wavetableSine[0];
+		synth->wavetable = &wavetableSine;
 		break;
 
 	case kSynth_Wavetable_Tri:
-		synth->wavetable = &wavetableTri[0];
+		synth->wavetable = &wavetableTri;
 		break;
 
 	case kSynth_Wavetable_Saw:
-		synth->wavetable = &wavetableSaw[0];
+		synth->wavetable = &wavetableSaw;
 		break;
 
 	case kSynth_Wavetable_Novel:
-		synth->wavetable = &wavetableNovel[0];
+		synth->wavetable = &wavetableNovel;
 		break;
 
 	default:
@@ -645,7 +1112,7 @@ void toggleActiveWavetable(wavetableSynth *synth) {
  * Presses all the constituent keys in a demo chord.
  */
 void playDemoChord(wavetableSynth *synth, uint32_t chordNum) {
-	for(int i = 0; i < NUM_DEMO_NOTES; i++) {
+	for(uint32_t i = 0; i < NUM_DEMO_NOTES; i++) {
 
 		pressKey(synth, demoChords[chordNum][i], 20);
 
@@ -658,7 +1125,7 @@ void playDemoChord(wavetableSynth *synth, uint32_t chordNum) {
  */
 void toggleDemoChord(wavetableSynth *synth) {
 
-	for(int i = 0; i < NUM_DEMO_NOTES; i++) {
+	for(uint32_t i = 0; i < NUM_DEMO_NOTES; i++) {
 		releaseKey(synth, demoChords[g_activeDemoChord][i]);
 	}
 
@@ -669,34 +1136,6 @@ void toggleDemoChord(wavetableSynth *synth) {
 }
 
 
-/*
- * getSAI_RequestSynthUpdate
- *
- * Safely reads SAI_RequestSynthUpdate
- *
- * Returns the read value
- */
-_Bool getSAI_RequestSynthUpdate() {
-
-	NVIC_DisableIRQ(SAI1_IRQn);
-	_Bool temp = SAI_RequestSynthUpdate;
-	NVIC_EnableIRQ(SAI1_IRQn);
-
-	return temp;
-}
-/*
- * clearSAI_RequestSynthUpdate
- *
- * Safely resets SAI_RequestSynthUpdate to 0
- */
-void clearSAI_RequestSynthUpdate() {
-
-	NVIC_DisableIRQ(SAI1_IRQn);
-	SAI_RequestSynthUpdate = 0;
-	NVIC_EnableIRQ(SAI1_IRQn);
-
-}
-
 /*
  * The calculation method used here was
  * learned from "Cookbook formulae for audio EQ
@@ -783,195 +1222,1836 @@ void calculateBiquadCoeffs(float *coeffs, float fC, float fS, filter_type_t filt
 
 
 /*
- * runLowpassBiquad
+ * initVoxDecimator
  *
- * Performs the antialiasing filter on the input.
- * Returns the next filtered output.
- *
- * Uses the input float[5] array of coefficients.
+ * Designs the voice decimator's lowpass (a Hamming-windowed sinc with
+ * its half-gain point at kResample_Phoneme_LP, unity gain at DC) and
+ * sets up the polyphase FIR. Everything above the analysis rate's
+ * Nyquist frequency lands in the stopband, well clear of the top band.
  *
- * This introduces a delay of two samples to the vocoder output.
+ * This delays the envelopes by kVoxDecimator_Delay frames.
  */
-float runLowpassBiquad(float newInput, float *coeffs) {
+void initVoxDecimator(void) {
 
-	float newOutput = coeffs[0] * newInput
-					+ coeffs[1] * lowpassBiquadInputs[0]
-					+ coeffs[2] * lowpassBiquadInputs[1]
-					- coeffs[3] * lowpassBiquadOutputs[0]
-					- coeffs[4] * lowpassBiquadOutputs[1];
+	float fc = (float)kResample_Phoneme_LP / kAudio_Frame_Hz;
+	float sum = 0;
 
-	lowpassBiquadInputs[1] = lowpassBiquadInputs[0];
-	lowpassBiquadInputs[0] = newInput;
+	for(uint32_t k = 0; k < kVoxDecimator_Taps; k++) {
 
-	lowpassBiquadOutputs[1] = lowpassBiquadOutputs[0];
-	lowpassBiquadOutputs[0] = newOutput;
+		int32_t n = (int32_t)k - kVoxDecimator_Delay;
+		float window = 0.54f - 0.46f * arm_cos_f32(2 * PI * k / (kVoxDecimator_Taps - 1));
 
-	return newOutput;
+		if(n == 0) voxDecimatorCoeffs[k] = 2 * fc;
+		else voxDecimatorCoeffs[k] = arm_sin_f32(2 * PI * fc * n) / (PI * n) * window;
+
+		sum += voxDecimatorCoeffs[k];
+	}
+	for(uint32_t k = 0; k < kVoxDecimator_Taps; k++) {
+		voxDecimatorCoeffs[k] /= sum;
+	}
+
+	arm_fir_decimate_init_f32(&voxDecimator, kVoxDecimator_Taps, kResample_Downsample_Rate,
+			voxDecimatorCoeffs, voxDecimatorState, kVoxDecimator_Max_Input);
+	voxDecimatorCarryCount = 0;
 }
 /*
- * runSibilanceBiquad
+ * decimateVoiceBlock
  *
- * Performs the high-frequency bypass filter on the input.
- * Returns the next filtered output.
+ * Runs a block of voice through the decimator, writing one
+ * downsampled sample per kResample_Downsample_Rate frames consumed.
+ * Frames that don't make up a whole group are carried to the next block.
  *
- * Uses the input float[5] array of coefficients.
+ * Each tick starts a new segment of the block, over which the band
+ * gains ramp to that tick's envelopes: segmentStart[t + 1] is the frame
+ * at which tick t's last input arrived. segmentStart[0] is 0, and the
+ * entry after the last tick is frames. Returns the number of ticks.
  */
-float runSibilanceBiquad(float newInput, float *coeffs) {
+uint32_t decimateVoiceBlock(const float *voice, size_t frames, float *downsampledVoice, uint32_t *segmentStart) {
 
-	float newOutput = coeffs[0] * newInput
-					+ coeffs[1] * sibilanceBiquadInputs[0]
-					+ coeffs[2] * sibilanceBiquadInputs[1]
-					- coeffs[3] * sibilanceBiquadOutputs[0]
-					- coeffs[4] * sibilanceBiquadOutputs[1];
+	float staged[kVoxDecimator_Max_Input + kResample_Downsample_Rate];
+	uint32_t carried = voxDecimatorCarryCount;
+	uint32_t staging = carried + frames;
+	uint32_t ticks = staging / kResample_Downsample_Rate;
+	uint32_t used = ticks * kResample_Downsample_Rate;
 
-	sibilanceBiquadInputs[1] = sibilanceBiquadInputs[0];
-	sibilanceBiquadInputs[0] = newInput;
+	arm_copy_f32(voxDecimatorCarry, staged, carried);
+	arm_copy_f32((float *)voice, &staged[carried], frames);
 
-	sibilanceBiquadOutputs[1] = sibilanceBiquadOutputs[0];
-	sibilanceBiquadOutputs[0] = newOutput;
+	if(ticks) {
+		arm_fir_decimate_f32(&voxDecimator, staged, downsampledVoice, used);
+	}
 
-	return newOutput;
+	voxDecimatorCarryCount = staging - used;
+	arm_copy_f32(&staged[used], voxDecimatorCarry, voxDecimatorCarryCount);
+
+	setTickSegments(segmentStart, ticks, carried, frames);
+
+	return ticks;
 }
 /*
- * runAnalysisBiquad
- *
- * Performs a series of analysis bandpass captures
- * on the filtered voice input; done every six CODEC samples.
- *
- * After running this function, the new analysis results
- * are available for further computation by calling
- * analysisBiquadOutputs[n][0] for the desired band.
- *
- * Uses the input float[NUM_VOCODER_BANDS * 5] array of coefficients.
+ * setTickSegments
  *
- * This introduces a delay of 12 samples to the vocoder output.
+ * Fills segmentStart for a block of frames that produced ticks
+ * downsampled samples, the decimator having carried frames over
+ * from the block before (see decimateVoiceBlock).
  */
-void runAnalysisBiquad(float newInput, float *coeffs) {
-
-	for(uint32_t i = 0; i < NUM_VOCODER_BANDS; ++i) {
-
-		analysisBiquadOutputs[i][2] = analysisBiquadOutputs[i][1];
-		analysisBiquadOutputs[i][1] = analysisBiquadOutputs[i][0];
+void setTickSegments(uint32_t *segmentStart, uint32_t ticks, uint32_t carried, size_t frames) {
 
-		analysisBiquadOutputs[i][0] = coeffs[5 * i] * newInput
-									+ coeffs[5 * i + 2] * analysisBiquadInputs[1]
-									- coeffs[5 * i + 3] * analysisBiquadOutputs[i][1]
-									- coeffs[5 * i + 4] * analysisBiquadOutputs[i][2];
-
-		analysisBiquadAbs[i] = fabsf(analysisBiquadOutputs[i][0]);
+	segmentStart[0] = 0;
+	for(uint32_t t = 0; t < ticks; t++) {
+		segmentStart[t + 1] = (t + 1) * kResample_Downsample_Rate - 1 - carried;
 	}
-
-	analysisBiquadInputs[1] = analysisBiquadInputs[0];
-	analysisBiquadInputs[0] = newInput;
+	segmentStart[ticks + 1] = frames;
 }
 /*
- * runEnvelopeFollower
+ * runSibilanceBiquadBlock
  *
- * Performs a series of lowpass filters on the absolute
- * value of the analysis filter results (inputArray).
- * This operation must be performed once the analysis
- * filter runs.
+ * Performs the high-frequency bypass filter on a block of inputs,
+ * writing one filtered output per input.
  *
  * Uses the input float[5] array of coefficients.
- *
- * After running this function, the new envelope results
- * are available in envelopeFollowerOutputs[n][0] for the desired band.
- *
- * Introduces one sample of delay. This is only
- * the case for performance reasons (lots of float operations
- * if this is done on the same sample as everything else).
  */
-void runEnvelopeFollower(float *inputArray, float *coeffs) {
+void runSibilanceBiquadBlock(const float *newInputs, float *newOutputs, uint32_t frames, float *coeffs) {
 
-	for(uint32_t i = 0; i < NUM_VOCODER_BANDS; ++i) {
+	float b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2], a1 = coeffs[3], a2 = coeffs[4];
+	float x1 = sibilanceBiquadInputs[0], x2 = sibilanceBiquadInputs[1];
+	float y1 = sibilanceBiquadOutputs[0], y2 = sibilanceBiquadOutputs[1];
 
-		envelopeFollowerOutputs[i][2] = envelopeFollowerOutputs[i][1];
-		envelopeFollowerOutputs[i][1] = envelopeFollowerOutputs[i][0];
+	for(uint32_t n = 0; n < frames; ++n) {
 
-		envelopeFollowerOutputs[i][0] = coeffs[0] * inputArray[i]
-									  + coeffs[1] * envelopeFollowerInputs[i][0]
-									  + coeffs[2] * envelopeFollowerInputs[i][1]
-									  - coeffs[3] * envelopeFollowerOutputs[i][1]
-									  - coeffs[4] * envelopeFollowerOutputs[i][2];
+		float x0 = newInputs[n];
+		float y0 = b0 * x0 + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
 
-		envelopeFollowerInputs[i][1] = envelopeFollowerInputs[i][0];
-		envelopeFollowerInputs[i][0] = inputArray[i];
+		x2 = x1;
+		x1 = x0;
+		y2 = y1;
+		y1 = y0;
 
+		newOutputs[n] = y0;
 	}
+
+	sibilanceBiquadInputs[0] = x1;
+	sibilanceBiquadInputs[1] = x2;
+	sibilanceBiquadOutputs[0] = y1;
+	sibilanceBiquadOutputs[1] = y2;
 }
 /*
- * runShapingBiquad
+ * runSibilanceBiquad
  *
- * Performs a series of shaping bandpass captures
- * on the synthesizer output; done once each CODEC sample.
+ * Single-sample wrapper for runSibilanceBiquadBlock.
+ * Returns the next filtered output.
+ */
+float runSibilanceBiquad(float newInput, float *coeffs) {
+
+	float newOutput;
+	runSibilanceBiquadBlock(&newInput, &newOutput, 1, coeffs);
+
+	return newOutput;
+}
+/*
+ * runAnalysisBiquadBlock
  *
- * After running this function, the new shaping results
- * are available for multiplication by calling
- * shapingBiquadOutputs[n][0] for the desired band.
+ * Performs the analysis bandpass captures of a vocoderConfig on a
+ * block of downsampled voice inputs, one band at a time.
  *
- * Uses the input float[NUM_VOCODER_BANDS * 5] array of coefficients.
+ * absOutputs receives the rectified result for each input
+ * and band, laid out as absOutputs[n * cfg->numBands + band].
+ * The final results also remain in cfg->analysisOutputs[n][0].
  *
- * Introduces a delay of 2 samples to the vocoder output.
- * This also introduces a delay of 2 samples to the synth output.
+ * This introduces a delay of 12 samples to the vocoder output.
  */
-void runShapingBiquad(float newInput, float *coeffs) {
+void runAnalysisBiquadBlock(vocoderConfig *cfg, const float *newInputs, float *absOutputs, uint32_t ticks) {
 
-	for(uint32_t i = 0; i < NUM_VOCODER_BANDS; ++i) {
+	uint32_t bands = cfg->numBands;
+	float *coeffs = cfg->analysisCoeffs;
+	float x1Start = cfg->analysisInputs[0], x2Start = cfg->analysisInputs[1];
+
+	for(uint32_t i = 0; i < bands; ++i) {
+
+		float b0 = coeffs[5 * i], b2 = coeffs[5 * i + 2], a1 = coeffs[5 * i + 3], a2 = coeffs[5 * i + 4];
+		float x1 = x1Start, x2 = x2Start;
+		float y1 = cfg->analysisOutputs[i][0], y2 = cfg->analysisOutputs[i][1];
+
+		for(uint32_t n = 0; n < ticks; ++n) {
+
+			float x0 = newInputs[n];
+			float y0 = b0 * x0 + b2 * x2 - a1 * y1 - a2 * y2; // b1 is always 0 for a bandpass
+
+			x2 = x1;
+			x1 = x0;
+			y2 = y1;
+			y1 = y0;
 
-		shapingBiquadOutputs[i][2] = shapingBiquadOutputs[i][1];
-		shapingBiquadOutputs[i][1] = shapingBiquadOutputs[i][0];
+			absOutputs[n * bands + i] = fabsf(y0);
+		}
 
-		shapingBiquadOutputs[i][0] = coeffs[5 * i] * newInput
-								   + coeffs[5 * i + 2] * shapingBiquadInputs[1]
-								   - coeffs[5 * i + 3] * shapingBiquadOutputs[i][1]
-								   - coeffs[5 * i + 4] * shapingBiquadOutputs[i][2];
+		cfg->analysisOutputs[i][0] = y1;
+		cfg->analysisOutputs[i][1] = y2;
 	}
 
-	shapingBiquadInputs[1] = shapingBiquadInputs[0];
-	shapingBiquadInputs[0] = newInput;
+	for(uint32_t n = 0; n < ticks; ++n) {
+		cfg->analysisInputs[1] = cfg->analysisInputs[0];
+		cfg->analysisInputs[0] = newInputs[n];
+	}
 }
+/*
+ * runAnalysisBiquad
+ *
+ * Single-sample wrapper for runAnalysisBiquadBlock; done every six CODEC samples.
+ *
+ * After running this function, the new analysis results
+ * are available for further computation by calling
+ * cfg->analysisOutputs[n][0] for the desired band.
+ */
+void runAnalysisBiquad(vocoderConfig *cfg, float newInput) {
 
+	float absOutputs[kVocoder_Max_Bands];
+	runAnalysisBiquadBlock(cfg, &newInput, absOutputs, 1);
 
+}
 /*
- * SAI1_IRQHandler
+ * runEnvelopeFollowerBlock
  *
- * Our CODEC simultaneous send/receive interrupt.
- * This interrupt is scheduled to occur whenever the Tx
- * FIFO hits its watermark at 16 words remaining.
+ * Performs a series of lowpass filters on a block of rectified
+ * analysis results, laid out as inputArray[n * cfg->numBands + band].
+ * This operation must be performed once the analysis filter runs.
  *
- * In the interrupt, we only update from/to the FIFOs
- * using our protected global audio arrays.
- *
- * These global arrays are updated using thread guarding
- * within our program loop.
+ * Uses the input float[5] array of coefficients.
  *
- * This ticks the audio sampling heartbeat of the application
- * with SAI_RequestSynthUpdate.
+ * outputArray receives the envelope for every input and band in the
+ * same layout. The final envelopes also remain in
+ * cfg->envelopeOutputs[n][0] for the desired band.
  */
-void SAI1_IRQHandler(void) {
+void runEnvelopeFollowerBlock(vocoderConfig *cfg, const float *inputArray, float *outputArray, uint32_t ticks, float *coeffs) {
 
-	// Read from FIFO into SAI1_rxAudio[2]
-	SAI1_rxAudio[0] = SAI_ReadData(SAI_1_PERIPHERAL, 0);
-	SAI1_rxAudio[1] = SAI_ReadData(SAI_1_PERIPHERAL, 0);
+	uint32_t bands = cfg->numBands;
+	float b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2], a1 = coeffs[3], a2 = coeffs[4];
 
-	// Write to FIFO from SAI1_txAudio[2]
-	SAI_WriteData(SAI_1_PERIPHERAL, 0, SAI1_txAudio[0]);
-	SAI_WriteData(SAI_1_PERIPHERAL, 0, SAI1_txAudio[1]);
+	for(uint32_t i = 0; i < bands; ++i) {
 
-	// Lastly, clear any halting status flags
-	SAI_RxClearStatusFlags(SAI_1_PERIPHERAL, kSAI_WordStartFlag | kSAI_FIFOErrorFlag);
-	SAI_TxClearStatusFlags(SAI_1_PERIPHERAL, kSAI_WordStartFlag | kSAI_FIFOErrorFlag);
+		float x1 = cfg->envelopeInputs[i][0], x2 = cfg->envelopeInputs[i][1];
+		float y1 = cfg->envelopeOutputs[i][0], y2 = cfg->envelopeOutputs[i][1];
 
-	SAI_RequestSynthUpdate = 1;
+		for(uint32_t n = 0; n < ticks; ++n) {
 
-}
+			float x0 = inputArray[n * bands + i];
+			float y0 = b0 * x0 + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
 
+			x2 = x1;
+			x1 = x0;
+			y2 = y1;
+			y1 = y0;
 
+			outputArray[n * bands + i] = y0;
+		}
+
+		cfg->envelopeInputs[i][0] = x1;
+		cfg->envelopeInputs[i][1] = x2;
+		cfg->envelopeOutputs[i][0] = y1;
+		cfg->envelopeOutputs[i][1] = y2;
+	}
+}
 /*
- * PIT_IRQHandler
+ * runEnvelopeFollower
  *
- * Used to digitally debounce the SW4 input.
- * Necessary to ensure each press and release results
+ * Single-sample wrapper for runEnvelopeFollowerBlock, run on
+ * the absolute value of the analysis filter results (inputArray).
+ *
+ * After running this function, the new envelope results
+ * are available in cfg->envelopeOutputs[n][0] for the desired band.
+ */
+void runEnvelopeFollower(vocoderConfig *cfg, float *inputArray, float *coeffs) {
+
+	float outputArray[kVocoder_Max_Bands];
+	runEnvelopeFollowerBlock(cfg, inputArray, outputArray, 1, coeffs);
+
+}
+/*
+ * runAttackReleaseFollowerBlock
+ *
+ * The cheaper alternative to runEnvelopeFollowerBlock, with the same
+ * layout of inputs and outputs: a one-pole follower per band, moving
+ * towards each input at the attack rate when it is above the envelope
+ * and at the release rate when it is below.
+ *
+ * In kFollower_Peak_Hold mode, a band holds its envelope for
+ * follower->holdTicks after its last new peak before releasing.
+ *
+ * Only envelopeOutputs is kept up to date, so a switch back to the
+ * biquad follower must go through setEnvelopeFollower.
+ */
+void runAttackReleaseFollowerBlock(vocoderConfig *cfg, const float *inputArray, float *outputArray, uint32_t ticks,
+		const envelopeFollower *follower) {
+
+	uint32_t bands = cfg->numBands;
+	float attack = follower->attackCoeff, release = follower->releaseCoeff;
+	uint32_t holdTicks = (follower->type == kFollower_Peak_Hold) ? follower->holdTicks : 0;
+
+	for(uint32_t i = 0; i < bands; ++i) {
+
+		float y = cfg->envelopeOutputs[i][0];
+		uint32_t hold = cfg->envelopeHold[i];
+
+		for(uint32_t n = 0; n < ticks; ++n) {
+
+			float x = inputArray[n * bands + i];
+
+			if(x >= y) {
+				y += attack * (x - y);
+				hold = holdTicks;
+			}
+			else if(hold) {
+				hold--;
+			}
+			else {
+				y += release * (x - y);
+			}
+
+			outputArray[n * bands + i] = y;
+		}
+
+		cfg->envelopeOutputs[i][0] = cfg->envelopeOutputs[i][1] = y;
+		cfg->envelopeHold[i] = hold;
+	}
+}
+/*
+ * setEnvelopeFollower
+ *
+ * Selects the follower type and its times, in milliseconds, working
+ * out the one-pole coefficients at the analysis rate. Times are clamped
+ * to the FOLLOWER_*_MS ranges.
+ *
+ * Both configs' follower state is reseeded from their current
+ * envelopes, so a change of type comes in without a jump.
+ * Call from the program loop.
+ */
+void setEnvelopeFollower(envelopeFollower *follower, follower_type_t type, float attackMs, float releaseMs, float holdMs) {
+
+	float analysisHz = (float)kAudio_Frame_Hz / kResample_Downsample_Rate;
+
+	if(attackMs < FOLLOWER_ATTACK_MIN_MS) attackMs = FOLLOWER_ATTACK_MIN_MS;
+	if(attackMs > FOLLOWER_ATTACK_MAX_MS) attackMs = FOLLOWER_ATTACK_MAX_MS;
+	if(releaseMs < FOLLOWER_RELEASE_MIN_MS) releaseMs = FOLLOWER_RELEASE_MIN_MS;
+	if(releaseMs > FOLLOWER_RELEASE_MAX_MS) releaseMs = FOLLOWER_RELEASE_MAX_MS;
+	if(holdMs < 0) holdMs = 0;
+	if(holdMs > FOLLOWER_HOLD_MAX_MS) holdMs = FOLLOWER_HOLD_MAX_MS;
+
+	follower->type = type;
+	follower->attackMs = attackMs;
+	follower->releaseMs = releaseMs;
+	follower->holdMs = holdMs;
+
+	follower->attackCoeff = 1.0f - expf(-1000.0f / (attackMs * analysisHz));
+	follower->releaseCoeff = 1.0f - expf(-1000.0f / (releaseMs * analysisHz));
+	follower->holdTicks = (uint32_t)(holdMs * analysisHz / 1000.0f);
+
+	for(uint32_t c = 0; c < 2; c++) {
+
+		vocoderConfig *cfg = &g_vocoderConfigs[c];
+
+		for(uint32_t b = 0; b < cfg->numBands; b++) {
+			float envelope = cfg->envelopeOutputs[b][0];
+			cfg->envelopeInputs[b][0] = cfg->envelopeInputs[b][1] = envelope;
+			cfg->envelopeOutputs[b][1] = envelope;
+			cfg->envelopeHold[b] = 0;
+		}
+	}
+}
+/*
+ * setBandpassBankCoeffs
+ *
+ * Loads one band of a bandpass bank from a float[5] array of
+ * coefficients, as made by calculateBiquadCoeffs, and clears its state.
+ */
+void setBandpassBankCoeffs(bandpassBiquadBank *bank, uint32_t band, const float *coeffs) {
+
+	assert(band < kVocoder_Max_Bands);
+
+	bank->b0[band] = coeffs[0];	// b1 is 0 and b2 is -b0 for a bandpass
+	bank->a1[band] = coeffs[3];
+	bank->a2[band] = coeffs[4];
+	bank->s1[band] = 0;
+	bank->s2[band] = 0;
+}
+/*
+ * runShapingBiquadBlock
+ *
+ * Runs bands firstBand up to endBand of a shaping bandpass bank over a
+ * block of synthesizer output at one rate of the octave tree.
+ * Each band's three coefficients and two state words are pulled
+ * into registers once, then the whole block is filtered in
+ * transposed direct form II: three multiplies per sample, no shifting.
+ *
+ * After running this function, the results for every frame
+ * are available in shapingBiquadBlock[frame][n], with the bands
+ * of each frame contiguous for the mix.
+ *
+ * Introduces a delay of 2 samples to the vocoder output.
+ * This also introduces a delay of 2 samples to the synth output.
+ */
+void runShapingBiquadBlock(const float *newInputs, uint32_t frames, bandpassBiquadBank *bank, uint32_t firstBand, uint32_t endBand) {
+
+	for(uint32_t i = firstBand; i < endBand; ++i) {
+
+		float b0 = bank->b0[i], a1 = bank->a1[i], a2 = bank->a2[i];
+		float s1 = bank->s1[i], s2 = bank->s2[i];
+
+		for(uint32_t n = 0; n < frames; ++n) {
+
+			float b0x0 = b0 * newInputs[n];
+			float y0 = b0x0 + s1;
+
+			s1 = s2 - a1 * y0;
+			s2 = -b0x0 - a2 * y0;
+
+			shapingBiquadBlock[n][i] = y0;
+		}
+
+		bank->s1[i] = s1;
+		bank->s2[i] = s2;
+	}
+}
+/*
+ * initCarrierOctaves
+ *
+ * Designs the half-band filter shared by every step of the octave
+ * tree (a Hamming-windowed sinc, unity gain at DC) and sets up the
+ * carrier's decimators. The interpolators get the same filter at
+ * twice the gain, to make up for the zeros they stuff in.
+ */
+void initCarrierOctaves(void) {
+
+	float sum = 0;
+
+	for(uint32_t k = 0; k < kHalfband_Taps; k++) {
+
+		int32_t n = (int32_t)k - kHalfband_Delay;
+
+		if(n == 0) halfbandDecimCoeffs[k] = 0.5f;
+		else if(n % 2 == 0) halfbandDecimCoeffs[k] = 0;
+		else halfbandDecimCoeffs[k] = arm_sin_f32(PI * n / 2) / (PI * n) * (0.54f + 0.46f * arm_cos_f32(PI * n / kHalfband_Delay));
+
+		sum += halfbandDecimCoeffs[k];
+	}
+	for(uint32_t k = 0; k < kHalfband_Taps; k++) {
+		halfbandDecimCoeffs[k] /= sum;
+		halfbandInterpCoeffs[k] = 2 * halfbandDecimCoeffs[k];
+	}
+	halfbandInterpCoeffs[kHalfband_Taps] = 0;
+
+	for(uint32_t level = 1; level < kVocoder_Rate_Levels; level++) {
+		arm_fir_decimate_init_f32(&carrierDecimators[level - 1], kHalfband_Taps, 2, halfbandDecimCoeffs,
+				carrierDecimatorStates[level - 1], kAudio_Block_Frames >> (level - 1));
+	}
+
+	arm_fill_f32(0, &carrierAlignLines[0][0], (kVocoder_Rate_Levels - 1) * (kVocoder_Align_Delay + kAudio_Block_Frames));
+}
+/*
+ * carrierAlignDelay
+ *
+ * Returns how long the carrier at a rate level must be held back,
+ * in samples at that rate, to line up with the round trip down
+ * and up through all the levels below it.
+ */
+uint32_t carrierAlignDelay(uint32_t level) {
+
+	uint32_t delay = 0;
+
+	for(uint32_t below = kVocoder_Rate_Levels - 1; below > level; below--) {
+		delay = 2 * delay + kHalfband_Round_Trip;
+	}
+
+	return delay;
+}
+/*
+ * splitCarrierOctaves
+ *
+ * Halves the carrier's rate down the octave tree and leaves each
+ * rate's carrier, delay-aligned, in carrierLevels[level].
+ * frames must be a multiple of 2^(kVocoder_Rate_Levels - 1).
+ */
+void splitCarrierOctaves(const float *carrier, uint32_t frames) {
+
+	float decimated[2][kAudio_Block_Frames / 2];
+	const float *levelIn = carrier;
+
+	for(uint32_t level = 0; level < kVocoder_Rate_Levels; level++) {
+
+		uint32_t n = frames >> level;
+
+		if(level > 0) {
+			float *levelOut = decimated[level & 1];
+			arm_fir_decimate_f32(&carrierDecimators[level - 1], (float *)levelIn, levelOut, n * 2);
+			levelIn = levelOut;
+		}
+
+		if(level == kVocoder_Rate_Levels - 1) {
+			arm_copy_f32((float *)levelIn, carrierLevels[level], n);
+		}
+		else {
+			/* Hold the newest n samples back by the level's delay */
+			float *line = carrierAlignLines[level];
+			uint32_t delay = carrierAlignDelay(level);
+
+			arm_copy_f32((float *)levelIn, &line[delay], n);
+			arm_copy_f32(line, carrierLevels[level], n);
+			arm_copy_f32(&line[n], line, delay);
+		}
+	}
+}
+
+
+/*
+ * setVocoderBands
+ *
+ * Copies a band layout into cfg: numBands center frequencies,
+ * highest first, and the analysis and shaping bandwidths of each
+ * band in octaves. Call buildVocoderConfig (or commitVocoderConfig)
+ * afterwards to bring the coefficients up to date.
+ */
+void setVocoderBands(vocoderConfig *cfg, uint32_t numBands, const float *f0, const float *analysisBWs, const float *shapingBWs) {
+
+	assert(numBands >= 1 && numBands <= kVocoder_Max_Bands);
+
+	for(uint32_t b = 0; b < numBands; b++) {
+		cfg->f0[b] = f0[b];
+		cfg->analysisBW[b] = analysisBWs[b];
+		cfg->shapingBW[b] = shapingBWs[b];
+		cfg->outputGain[b] = 1.0f;
+	}
+
+	cfg->numBands = numBands;
+	cfg->maxHz = f0[0];
+	cfg->minHz = f0[numBands - 1];
+}
+/*
+ * setVocoderBandsLogSpaced
+ *
+ * Lays numBands bands into cfg, with centers evenly spaced in log
+ * frequency from maxHz down to minHz, all starting with the same
+ * bandwidths. Individual bands' bandwidths can be edited afterwards.
+ */
+void setVocoderBandsLogSpaced(vocoderConfig *cfg, uint32_t numBands, float minHz, float maxHz, float analysisBW, float shapingBW) {
+
+	assert(numBands >= 1 && numBands <= kVocoder_Max_Bands);
+
+	float ratio = (numBands > 1) ? powf(minHz / maxHz, 1.0f / (numBands - 1)) : 1.0f;
+	float f0 = (numBands > 1) ? maxHz : sqrtf(minHz * maxHz);
+
+	for(uint32_t b = 0; b < numBands; b++) {
+		cfg->f0[b] = f0;
+		cfg->analysisBW[b] = analysisBW;
+		cfg->shapingBW[b] = shapingBW;
+		cfg->outputGain[b] = 1.0f;
+		f0 *= ratio;
+	}
+
+	cfg->numBands = numBands;
+	cfg->maxHz = maxHz;
+	cfg->minHz = minHz;
+}
+/*
+ * setVocoderBandGain
+ *
+ * Sets the output level of one band of cfg (1.0 is unity), for
+ * shaping the vocoder's tone. Takes effect from the next block, and
+ * costs nothing in the mix, as it rides on the band's gain ramp.
+ * The Q31 engine picks it up at the next commitVocoderConfig.
+ * Bands are numbered highest first.
+ */
+void setVocoderBandGain(vocoderConfig *cfg, uint32_t band, float gain) {
+
+	assert(band < cfg->numBands);
+
+	cfg->outputGain[band] = gain;
+}
+/*
+ * getIdleVocoderConfig
+ *
+ * Returns the config the audio path is not running, to be filled in
+ * and handed to commitVocoderConfig. Call from the program loop.
+ */
+vocoderConfig *getIdleVocoderConfig(void) {
+
+	return &g_vocoderConfigs[g_activeVocoderConfig ^ 1];
+}
+/*
+ * buildVocoderConfig
+ *
+ * Computes the analysis and shaping coefficients for the bands in
+ * cfg, assigns each band its rate in the octave tree,
+ * and clears its filter state.
+ *
+ * Works out how long cfg must run before it is heard from the slowest
+ * pole of its filters: a pole of radius r decays by 1/e every -1/ln(r)
+ * samples, and r^2 is the biquad's a2.
+ */
+void buildVocoderConfig(vocoderConfig *cfg) {
+
+	float coeffs[5];
+	uint32_t level = 0;
+	float ringFrames = 0;
+
+	for(uint32_t l = 0; l <= kVocoder_Rate_Levels; l++) {
+		cfg->levelFirstBand[l] = cfg->numBands;
+	}
+	cfg->levelFirstBand[0] = 0;
+
+	for(uint32_t b = 0; b < cfg->numBands; b++) {
+
+		/* calculate voice analysis filter coefficients per band */
+		calculateBiquadCoeffs(&cfg->analysisCoeffs[b * 5], cfg->f0[b],
+				(float)kAudio_Frame_Hz / kResample_Downsample_Rate, kFilter_Band_Pass, cfg->analysisBW[b]);
+
+		/* pick the lowest rate with room for the band, never higher than the band above's */
+		while(level < kVocoder_Rate_Levels - 1 && cfg->f0[b] * kVocoder_Rate_Per_F0 <= (kAudio_Frame_Hz >> (level + 1))) {
+			level++;
+			cfg->levelFirstBand[level] = b;
+		}
+
+		/* calculate synth shaping filter coefficients per band, at its rate */
+		calculateBiquadCoeffs(coeffs, cfg->f0[b],
+				(float)(kAudio_Frame_Hz >> level), kFilter_Band_Pass, cfg->shapingBW[b]);
+		setBandpassBankCoeffs(&cfg->shaping, b, coeffs);
+
+		ringFrames = fmaxf(ringFrames, -2.0f * (1U << level) / logf(coeffs[4]));
+		ringFrames = fmaxf(ringFrames, -2.0f * kResample_Downsample_Rate / logf(cfg->analysisCoeffs[b * 5 + 4]));
+
+		cfg->analysisOutputs[b][0] = cfg->analysisOutputs[b][1] = 0;
+		cfg->envelopeInputs[b][0] = cfg->envelopeInputs[b][1] = 0;
+		cfg->envelopeOutputs[b][0] = cfg->envelopeOutputs[b][1] = 0;
+		cfg->envelopeHold[b] = 0;
+		cfg->envelopeRampFrom[b] = 0;
+	}
+
+	cfg->analysisInputs[0] = cfg->analysisInputs[1] = 0;
+	cfg->warmupBlocks = (uint32_t)ceilf(kVocoder_Warmup_Time_Constants * ringFrames / kAudio_Block_Frames);
+
+	for(uint32_t l = 1; l < kVocoder_Rate_Levels; l++) {
+		arm_fir_interpolate_init_f32(&cfg->upsamplers[l - 1], 2, kHalfband_Interp_Taps, halfbandInterpCoeffs,
+				cfg->upsamplerStates[l - 1], kAudio_Block_Frames >> l);
+	}
+}
+/*
+ * seedVocoderEnvelopes
+ *
+ * Starts each band of cfg with the envelope of the nearest band
+ * (in log frequency) of another config, so a new layout comes in
+ * at the level the old one had reached instead of from silence.
+ */
+void seedVocoderEnvelopes(vocoderConfig *cfg, const vocoderConfig *from) {
+
+	for(uint32_t b = 0; b < cfg->numBands; b++) {
+
+		uint32_t nearest = 0;
+		float nearestDist = fabsf(logf(from->f0[0] / cfg->f0[b]));
+
+		for(uint32_t k = 1; k < from->numBands; k++) {
+			float dist = fabsf(logf(from->f0[k] / cfg->f0[b]));
+			if(dist < nearestDist) {
+				nearest = k;
+				nearestDist = dist;
+			}
+		}
+
+		float envelope = from->envelopeOutputs[nearest][0];
+		cfg->envelopeInputs[b][0] = cfg->envelopeInputs[b][1] = envelope;
+		cfg->envelopeOutputs[b][0] = cfg->envelopeOutputs[b][1] = envelope;
+		cfg->envelopeRampFrom[b] = envelope;
+	}
+}
+/*
+ * commitVocoderConfig
+ *
+ * Builds cfg, the idle config, and queues it to be swapped in. It runs
+ * from the next audio block, unheard until it has warmed up (see
+ * kVocoder_Warmup_Time_Constants), then is crossfaded in. Committing
+ * again before then starts the change-over again. The STFT engine takes
+ * up the new band count and span as well, and the Q31 engine the new bands.
+ * Call from the program loop.
+ */
+void commitVocoderConfig(vocoderConfig *cfg) {
+
+	assert(cfg == getIdleVocoderConfig());
+
+	buildVocoderConfig(cfg);
+	seedVocoderEnvelopes(cfg, &g_vocoderConfigs[g_activeVocoderConfig]);
+	setStftBands(&g_stftVocoder, cfg->numBands, cfg->minHz, cfg->maxHz);
+	setFixedBands(&g_fixedVocoder, cfg);
+
+	g_vocoderConfigBlocks = 0;
+	g_vocoderConfigPending = 1;
+}
+/*
+ * runVocoderBands
+ *
+ * Runs the band-dependent part of the biquad engine for one config:
+ * analysis and envelope following of the downsampled voice, shaping of
+ * the split carrier at each band's rate, and the sum of the shaped
+ * bands under their envelopes, interpolated back up to full rate.
+ *
+ * vocoded receives the modulated synth for each frame. Each tick
+ * starts a new segment of the block (see decimateVoiceBlock), over which
+ * the band gains ramp to that tick's envelopes. splitCarrierOctaves
+ * must have run.
+ *
+ * Without voiceActive, the voice isn't analysed, and the envelopes
+ * are held or decayed as the VAD mode says.
+ */
+void runVocoderBands(vocoderConfig *cfg, const float *downsampledVoice, uint32_t ticks, _Bool voiceActive,
+		const uint32_t *segmentStart, float *vocoded, uint32_t frames) {
+
+	uint32_t bands = cfg->numBands;
+	float upsampled[kAudio_Block_Frames];
+
+	/* Segment 0 keeps the envelopes left over from the last block */
+	for(uint32_t i = 0; i < bands; ++i) {
+		vocoderEnvelopes[i] = cfg->envelopeOutputs[i][0];
+	}
+	if(voiceActive) {
+		runAnalysisBiquadBlock(cfg, downsampledVoice, vocoderAnalysisAbs, ticks);		// Capture the filtered amplitude from each downsampled voice band
+		if(g_envelopeFollower.type == kFollower_Biquad) {
+			runEnvelopeFollowerBlock(cfg, vocoderAnalysisAbs, &vocoderEnvelopes[bands], ticks, envelopeFollowerCoeffs);
+		}
+		else {
+			runAttackReleaseFollowerBlock(cfg, vocoderAnalysisAbs, &vocoderEnvelopes[bands], ticks, &g_envelopeFollower);
+		}
+	}
+	else {
+		/* Nobody is speaking: hold or decay the envelopes, leaving the followers ready to pick up from there */
+		float decay = (g_vad.mode == kVad_Freeze) ? 1.0f : g_vad.envelopeDecay;
+
+		for(uint32_t i = 0; i < bands; ++i) {
+
+			float envelope = cfg->envelopeOutputs[i][0];
+
+			for(uint32_t n = 0; n < ticks; ++n) {
+				envelope *= decay;
+				vocoderEnvelopes[(n + 1) * bands + i] = envelope;
+			}
+
+			cfg->envelopeInputs[i][0] = cfg->envelopeInputs[i][1] = envelope;
+			cfg->envelopeOutputs[i][0] = cfg->envelopeOutputs[i][1] = envelope;
+			cfg->envelopeHold[i] = 0;
+		}
+	}
+
+	/*
+	 * Turn the envelopes into gain ramps, with VOCODER_MIX_GAIN and the
+	 * band's output gain folded in.
+	 * Each tick's envelope is reached over the kResample_Downsample_Rate
+	 * frames after it arrives, so over segment s the gain of a band is
+	 * vocoderEnvelopes[s] + vocoderGainSlopes[s] * frame. Segment 0 finishes
+	 * the ramp the last block began. Done in place, last segment first.
+	 */
+	for(uint32_t i = 0; i < bands; ++i) {
+
+		float from = cfg->envelopeRampFrom[i];
+		float scale = VOCODER_MIX_GAIN * cfg->outputGain[i];
+
+		if(ticks) cfg->envelopeRampFrom[i] = vocoderEnvelopes[(ticks - 1) * bands + i];
+
+		for(int32_t s = ticks; s >= 0; --s) {
+
+			float target = vocoderEnvelopes[s * bands + i];
+			float previous = s ? vocoderEnvelopes[(s - 1) * bands + i] : from;
+			float slope = (target - previous) * (scale / kResample_Downsample_Rate);
+
+			vocoderGainSlopes[s * bands + i] = slope;
+			if(s) vocoderEnvelopes[s * bands + i] = previous * scale + slope * (1.0f - segmentStart[s]);
+			else vocoderEnvelopes[i] = target * scale - slope * ((float)segmentStart[1] - 1.0f);
+		}
+	}
+
+	for(uint32_t level = 0; level < kVocoder_Rate_Levels; level++) {
+
+		uint32_t n = frames >> level;
+		uint32_t first = cfg->levelFirstBand[level], end = cfg->levelFirstBand[level + 1];
+		uint32_t seg = 0;
+
+		runShapingBiquadBlock(carrierLevels[level], n, &cfg->shaping, first, end);	// Capture the filtered amplitude from each synth band
+
+		if(first == end) {
+			arm_fill_f32(0, vocodedLevels[level], n);
+			continue;
+		}
+
+		/*
+		 * Each sample at this rate takes the gain ramps of the segment its
+		 * first frame falls in. The band outputs, intercepts and slopes are
+		 * all contiguous across bands, so the sum splits into two dot products.
+		 */
+		for(uint32_t m = 0; m < n; ++m) {
+
+			while(seg < ticks && segmentStart[seg + 1] <= (m << level)) seg++;
+
+			float flat, ramp;
+
+			arm_dot_prod_f32(&shapingBiquadBlock[m][first], &vocoderEnvelopes[seg * bands + first], end - first, &flat);
+			arm_dot_prod_f32(&shapingBiquadBlock[m][first], &vocoderGainSlopes[seg * bands + first], end - first, &ramp);
+
+			vocodedLevels[level][m] = flat + ramp * (float)(m << level);
+		}
+	}
+
+	/* Fold each rate's sum back up into the one above it */
+	for(uint32_t level = kVocoder_Rate_Levels - 1; level > 0; level--) {
+		uint32_t n = frames >> level;
+		arm_fir_interpolate_f32(&cfg->upsamplers[level - 1], vocodedLevels[level], upsampled, n);
+		arm_add_f32(vocodedLevels[level - 1], upsampled, vocodedLevels[level - 1], 2 * n);
+	}
+
+	arm_copy_f32(vocodedLevels[0], vocoded, frames);
+}
+
+
+/*
+ * initVoiceActivity
+ *
+ * Starts the VAD off silent, with the noise floor at VAD_MIN_ENERGY,
+ * and works out the envelope decay for the analysis rate.
+ */
+void initVoiceActivity(voiceActivityDetector *vad, vad_mode_t mode) {
+
+	float analysisHz = (float)kAudio_Frame_Hz / kResample_Downsample_Rate;
+
+	vad->mode = mode;
+	vad->energy = 0;
+	vad->crossings = 0;
+	vad->frameTicks = 0;
+	vad->lastSample = 0;
+	vad->noiseFloor = VAD_MIN_ENERGY;
+	vad->hangover = 0;
+
+	vad->active = 0;
+	vad->silentTicks = 0;
+	vad->envelopeDecay = expf(-1000.0f / (VAD_DECAY_MS * analysisHz));
+	vad->gateTicks = (uint32_t)(7.0f * VAD_DECAY_MS * analysisHz / 1000.0f); // 7 time constants, about -60 dB
+	vad->passthroughLevel = 0;
+}
+/*
+ * updateVoiceActivity
+ *
+ * Feeds a block's downsampled voice to the VAD, judging each VAD
+ * frame as it completes. Returns whether the vocoder should analyse
+ * the voice: always, with the VAD off.
+ */
+_Bool updateVoiceActivity(voiceActivityDetector *vad, const float *downsampledVoice, uint32_t ticks) {
+
+	for(uint32_t n = 0; n < ticks; ++n) {
+
+		float x = downsampledVoice[n];
+
+		vad->energy += x * x;
+		if((x >= 0) != (vad->lastSample >= 0)) vad->crossings++;
+		vad->lastSample = x;
+
+		if(++vad->frameTicks < kVad_Frame_Ticks) continue;
+
+		float energy = vad->energy / kVad_Frame_Ticks;
+		float zcr = (float)vad->crossings / kVad_Frame_Ticks;
+		float threshold = vad->noiseFloor * VAD_ENERGY_RATIO;
+
+		if(threshold < VAD_MIN_ENERGY) threshold = VAD_MIN_ENERGY;
+
+		if(energy > threshold || (energy > threshold / 4 && zcr > VAD_ZCR_THRESHOLD)) {
+			vad->hangover = kVad_Hangover_Frames;
+		}
+		else {
+			if(vad->hangover) vad->hangover--;
+
+			/* Track the floor down at once, and up slowly */
+			if(energy < vad->noiseFloor) vad->noiseFloor = energy;
+			else vad->noiseFloor += VAD_FLOOR_ADAPT * (energy - vad->noiseFloor);
+		}
+
+		vad->active = (vad->hangover > 0);
+		vad->energy = 0;
+		vad->crossings = 0;
+		vad->frameTicks = 0;
+	}
+
+	if(vad->active) vad->silentTicks = 0;
+	else if(vad->silentTicks < vad->gateTicks) vad->silentTicks += ticks;
+
+	return vad->active || vad->mode == kVad_Off;
+}
+/*
+ * isVocoderGated
+ *
+ * Returns whether the envelopes have been left to decay long enough
+ * that the band stage can be skipped altogether.
+ */
+_Bool isVocoderGated(const voiceActivityDetector *vad) {
+
+	if(vad->mode == kVad_Off || vad->mode == kVad_Freeze) return 0;
+
+	return !vad->active && vad->silentTicks >= vad->gateTicks;
+}
+/*
+ * initVoicing
+ *
+ * Starts the classifier off voiced, with the sibilance gate shut.
+ */
+void initVoicing(voicingClassifier *uv, sibilance_mode_t mode) {
+
+	uv->mode = mode;
+	uv->highLevel = 0;
+	uv->lowLevel = 0;
+	uv->zcr = 0;
+	uv->lastSample = 0;
+	uv->unvoiced = 0;
+	uv->gate = 0;
+
+	uv->noiseSeed = 1;
+	uv->noiseInputs[0] = uv->noiseInputs[1] = 0;
+	uv->noiseOutputs[0] = uv->noiseOutputs[1] = 0;
+}
+/*
+ * updateVoicing
+ *
+ * Classifies a block from its rectified analysis bands, laid out as
+ * for runAnalysisBiquadBlock, and its downsampled voice. With no ticks
+ * (the voice wasn't analysed) the block counts as voiced.
+ */
+void updateVoicing(voicingClassifier *uv, const vocoderConfig *cfg, const float *absBands,
+		const float *downsampledVoice, uint32_t ticks) {
+
+	uint32_t bands = cfg->numBands;
+	uint32_t highBands = 0;
+	float high = 0, low = 0;
+	uint32_t crossings = 0;
+
+	if(ticks == 0) {
+		uv->unvoiced = 0;
+		return;
+	}
+
+	/* The bands run highest first */
+	while(highBands < bands && cfg->f0[highBands] >= UV_SPLIT_HZ) highBands++;
+
+	for(uint32_t n = 0; n < ticks; ++n) {
+
+		const float *levels = &absBands[n * bands];
+
+		for(uint32_t i = 0; i < highBands; ++i) high += levels[i];
+		for(uint32_t i = highBands; i < bands; ++i) low += levels[i];
+
+		float x = downsampledVoice[n];
+		if((x >= 0) != (uv->lastSample >= 0)) crossings++;
+		uv->lastSample = x;
+	}
+
+	if(highBands) high /= highBands * ticks;
+	if(bands > highBands) low /= (bands - highBands) * ticks;
+
+	uv->highLevel += UV_SMOOTHING * (high - uv->highLevel);
+	uv->lowLevel += UV_SMOOTHING * (low - uv->lowLevel);
+	uv->zcr += UV_SMOOTHING * ((float)crossings / ticks - uv->zcr);
+
+	uv->unvoiced = (uv->highLevel > UV_LEVEL_RATIO * uv->lowLevel) && (uv->zcr > UV_ZCR_THRESHOLD);
+}
+/*
+ * applySibilanceGate
+ *
+ * Ramps the gate towards the classifier's verdict over the block
+ * and applies it to the high-passed voice in sibilance, or replaces
+ * that with shaped noise, as the mode says.
+ *
+ * The noise is white noise through the sibilance filter, following
+ * the level of the high analysis bands.
+ */
+void applySibilanceGate(voicingClassifier *uv, float *sibilance, uint32_t frames) {
+
+	float from = uv->gate;
+	float to = uv->unvoiced ? 1.0f : 0.0f;
+
+	if(uv->mode == kSibilance_Always) return;
+
+	if(to > from + UV_GATE_STEP) to = from + UV_GATE_STEP;
+	if(to < from - UV_GATE_STEP) to = from - UV_GATE_STEP;
+	uv->gate = to;
+
+	if(uv->mode == kSibilance_Gated) {
+		for(uint32_t n = 0; n < frames; ++n) {
+			sibilance[n] *= from + (float)(n + 1) / frames * (to - from);
+		}
+		return;
+	}
+
+	if(from == 0 && to == 0) {
+		arm_fill_f32(0, sibilance, frames);
+		return;
+	}
+
+	float b0 = sibilanceBiquadCoeffs[0], b1 = sibilanceBiquadCoeffs[1], b2 = sibilanceBiquadCoeffs[2];
+	float a1 = sibilanceBiquadCoeffs[3], a2 = sibilanceBiquadCoeffs[4];
+	float x1 = uv->noiseInputs[0], x2 = uv->noiseInputs[1];
+	float y1 = uv->noiseOutputs[0], y2 = uv->noiseOutputs[1];
+	float level = UV_NOISE_GAIN * uv->highLevel;
+	uint32_t seed = uv->noiseSeed;
+
+	for(uint32_t n = 0; n < frames; ++n) {
+
+		seed = seed * 1664525U + 1013904223U;
+
+		float x0 = (float)(int32_t)seed * (1.0f / 2147483648.0f);
+		float y0 = b0 * x0 + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+
+		x2 = x1;
+		x1 = x0;
+		y2 = y1;
+		y1 = y0;
+
+		sibilance[n] = y0 * level * (from + (float)(n + 1) / frames * (to - from));
+	}
+
+	uv->noiseSeed = seed;
+	uv->noiseInputs[0] = x1;
+	uv->noiseInputs[1] = x2;
+	uv->noiseOutputs[0] = y1;
+	uv->noiseOutputs[1] = y2;
+}
+/*
+ * enableCycleCounter
+ *
+ * Starts the DWT cycle counter, used by the load meter and the benchmarks.
+ */
+void enableCycleCounter(void) {
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->LAR = 0xC5ACCE55; // Unlock the DWT on the M7
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+/*
+ * updateAudioLoadMeter
+ *
+ * Takes the cycles spent on a block of frames into the meter.
+ */
+void updateAudioLoadMeter(audioLoadMeter *meter, uint32_t cycles, size_t frames) {
+
+	uint32_t period = (uint32_t)((uint64_t)SystemCoreClock * frames / kAudio_Frame_Hz);
+
+	meter->blockCycles = cycles;
+	if(cycles > meter->peakCycles) meter->peakCycles = cycles;
+	meter->spareCycles = (cycles < period) ? period - cycles : 0;
+	meter->load += AUDIO_LOAD_SMOOTHING * ((float)cycles / period - meter->load);
+}
+/*
+ * reportAudioLoad
+ *
+ * Prints the meter and starts a new peak. Call from the program loop,
+ * between blocks; the console is too slow for the audio path.
+ */
+void reportAudioLoad(audioLoadMeter *meter) {
+
+	uint32_t period = (uint32_t)((uint64_t)SystemCoreClock * kAudio_Block_Frames / kAudio_Frame_Hz);
+
+	PRINTF("Audio load: %d%% average, peak %d of %d cycles per block\n",
+			(int)(meter->load * 100.0f + 0.5f), meter->peakCycles, period);
+
+	meter->peakCycles = 0;
+	meter->reportPending = 0;
+}
+
+
+/*
+ * processAudioBlock
+ *
+ * Runs the whole voice-to-output chain over a block of CODEC frames:
+ * decimation and the sibilance filter on the voice, analysis and
+ * envelope following on the downsampled voice, synth rendering,
+ * shaping, and the final modulated mix.
+ *
+ * Each stage runs over the whole block before the next begins,
+ * so coefficients and filter state stay in registers.
+ *
+ * A newly committed vocoderConfig runs alongside the old one, unheard,
+ * for its warmupBlocks while its filters ring up, then the output is
+ * crossfaded to it over kVocoder_Crossfade_Blocks, and it replaces the
+ * old one.
+ *
+ * The VAD decides how much of the band stage runs (see
+ * voiceActivityDetector), and can fade in the dry synth instead.
+ * The voicing classifier decides when the sibilance goes out.
+ *
+ * Hands the block to the STFT or Q31 engine instead when one is selected.
+ *
+ * in and out hold interleaved {left, right} frames of 24-bit audio;
+ * frames must not exceed kAudio_Block_Frames, and must be a multiple
+ * of 2^(kVocoder_Rate_Levels - 1) for the octave tree.
+ */
+void processAudioBlock(const int32_t *in, int32_t *out, size_t frames) {
+
+	float voice[kAudio_Block_Frames] = {0};	// zeroed so -Wmaybe-uninitialized sees it set, however short the block
+	float sibilanceBypass[kAudio_Block_Frames];
+	float carrier[kAudio_Block_Frames] = {0};
+	float vocoded[kAudio_Block_Frames];
+	int32_t synthOut[kAudio_Block_Frames];
+
+	float downsampledVoice[kVocoder_Max_Block_Ticks] = {0};
+	uint32_t segmentStart[kVocoder_Max_Block_Ticks + 2];
+	uint32_t ticks;
+	_Bool voiceActive;
+
+	assert(frames <= kAudio_Block_Frames);
+	assert((frames & ((1U << (kVocoder_Rate_Levels - 1)) - 1)) == 0);
+
+	if(g_vocoderEngine == kVocoder_Engine_Stft) {
+		processStftBlock(&g_stftVocoder, in, out, frames);
+		return;
+	}
+	if(g_vocoderEngine == kVocoder_Engine_Fixed) {
+		processFixedBlock(&g_fixedVocoder, in, out, frames);
+		return;
+	}
+
+	/* The mic sits on the right channel */
+	for(uint32_t n = 0; n < frames; ++n) {
+		voice[n] = (float)in[n * kAudio_Buffer_Words + 1];
+	}
+
+	ticks = decimateVoiceBlock(voice, frames, downsampledVoice, segmentStart);		// Save the downsampled voice
+	runSibilanceBiquadBlock(voice, sibilanceBypass, frames, sibilanceBiquadCoeffs);	// Save the high-passed voice
+	voiceActive = updateVoiceActivity(&g_vad, downsampledVoice, ticks);
+
+	playScheduledSynthBlock(&g_demoSynth, &g_midiSchedule, synthOut, frames);
+	for(uint32_t n = 0; n < frames; ++n) {
+		carrier[n] = (float)synthOut[n];
+	}
+
+	if(isVocoderGated(&g_vad)) {
+
+		/* The envelopes are gone, so there is nothing to shape */
+		arm_fill_f32(0, vocoded, frames);
+		updateVoicing(&g_voicing, &g_vocoderConfigs[g_activeVocoderConfig], vocoderAnalysisAbs, downsampledVoice, 0);
+
+		if(g_vocoderConfigPending) {
+			g_activeVocoderConfig ^= 1;
+			g_vocoderConfigPending = 0;
+		}
+	}
+	else {
+
+		splitCarrierOctaves(carrier, frames);
+		runVocoderBands(&g_vocoderConfigs[g_activeVocoderConfig], downsampledVoice, ticks, voiceActive, segmentStart, vocoded, frames);
+		updateVoicing(&g_voicing, &g_vocoderConfigs[g_activeVocoderConfig], vocoderAnalysisAbs,
+				downsampledVoice, voiceActive ? ticks : 0);
+
+		/* Run a newly committed band layout beside this one until it has rung up, then crossfade to it */
+		if(g_vocoderConfigPending) {
+
+			float incoming[kAudio_Block_Frames];
+			vocoderConfig *next = &g_vocoderConfigs[g_activeVocoderConfig ^ 1];
+			uint32_t block = g_vocoderConfigBlocks++;
+
+			runVocoderBands(next, downsampledVoice, ticks, voiceActive, segmentStart, incoming, frames);
+
+			if(block >= next->warmupBlocks) {
+
+				uint32_t fade = block - next->warmupBlocks;
+				float step = 1.0f / (kVocoder_Crossfade_Blocks * frames);
+
+				for(uint32_t n = 0; n < frames; ++n) {
+					vocoded[n] += (float)(fade * frames + n + 1) * step * (incoming[n] - vocoded[n]);
+				}
+
+				if(fade + 1 >= kVocoder_Crossfade_Blocks) {
+					g_activeVocoderConfig ^= 1;
+					g_vocoderConfigPending = 0;
+				}
+			}
+		}
+	}
+
+	/* Let consonants through, or stand in for them */
+	applySibilanceGate(&g_voicing, sibilanceBypass, frames);
+
+	/* Fade the dry synth in while nobody is speaking, if asked to */
+	float passFrom = g_vad.passthroughLevel;
+	float passTo = (g_vad.mode == kVad_Passthrough && !g_vad.active) ? 1.0f : 0.0f;
+
+	if(passTo > passFrom + VAD_PASSTHROUGH_STEP) passTo = passFrom + VAD_PASSTHROUGH_STEP;
+	if(passTo < passFrom - VAD_PASSTHROUGH_STEP) passTo = passFrom - VAD_PASSTHROUGH_STEP;
+	g_vad.passthroughLevel = passTo;
+
+	if(passFrom > 0 || passTo > 0) {
+		for(uint32_t n = 0; n < frames; ++n) {
+			float level = passFrom + (float)(n + 1) / frames * (passTo - passFrom);
+			vocoded[n] += carrier[n] * (VAD_PASSTHROUGH_GAIN * level);
+		}
+	}
+
+	/* Modulate the synth data, adding in consonants from speech */
+	for(uint32_t n = 0; n < frames; ++n) {
+		out[n * kAudio_Buffer_Words] = (int32_t)(sibilanceBypass[n] + vocoded[n]);
+		out[n * kAudio_Buffer_Words + 1] = out[n * kAudio_Buffer_Words];
+	}
+}
+
+
+/*
+ * initStftVocoder
+ *
+ * Sets up the FFT and the analysis window of the STFT engine,
+ * and lays out its bands (see setStftBands).
+ */
+void initStftVocoder(stftVocoder *stft, uint32_t numBands, float minHz, float maxHz) {
+
+	float windowSum = 0;
+
+	arm_rfft_fast_init_f32(&stft->fft, kStft_Frame_Length);
+
+	/* A periodic sqrt-Hann on both analysis and synthesis sums to one at 50% overlap */
+	for(uint32_t n = 0; n < kStft_Frame_Length; n++) {
+		stftWindow[n] = arm_sin_f32(PI * n / kStft_Frame_Length);
+		windowSum += stftWindow[n];
+	}
+	stft->envelopeScale = 2.0f / windowSum;
+
+	setStftBands(stft, numBands, minHz, maxHz);
+	resetStftVocoder(stft);
+}
+/*
+ * setStftBands
+ *
+ * Lays out numBands bands for the STFT engine, centered log-spaced
+ * from minHz to maxHz. Each band is given at least one bin, so the
+ * lowest bands may be pushed up a little when they are narrower
+ * than the bin spacing. Band envelopes carry over.
+ */
+void setStftBands(stftVocoder *stft, uint32_t numBands, float minHz, float maxHz) {
+
+	float binHz = (float)kAudio_Frame_Hz / kStft_Frame_Length;
+
+	assert(numBands >= 1 && numBands <= kStft_Max_Bands);
+
+	/* Band edges fall halfway (in log frequency) between neighboring centers */
+	float ratio = (numBands > 1) ? powf(maxHz / minHz, 1.0f / (numBands - 1)) : 2.0f;
+	float edgeHz = minHz / sqrtf(ratio);
+	uint32_t lastEdge = 0;
+
+	for(uint32_t b = 0; b <= numBands; b++) {
+
+		uint32_t edge = (uint32_t)(edgeHz / binHz + 0.5f);
+		if(edge <= lastEdge) edge = lastEdge + 1;
+		if(edge > kStft_Bins) edge = kStft_Bins;
+
+		stft->bandEdge[b] = edge;
+		lastEdge = edge;
+		edgeHz *= ratio;
+	}
+
+	stft->sibilanceBin = (uint16_t)ceilf(kResample_Sibilance_HP / binHz);
+	if(stft->sibilanceBin < stft->bandEdge[numBands]) stft->sibilanceBin = stft->bandEdge[numBands];
+
+	stft->numBands = numBands;
+}
+/*
+ * resetStftVocoder
+ *
+ * Clears the STFT engine's buffers and envelopes, so it starts
+ * from silence. Done whenever the engine is switched in.
+ */
+void resetStftVocoder(stftVocoder *stft) {
+
+	arm_fill_f32(0, stftVoiceIn, kStft_Frame_Length);
+	arm_fill_f32(0, stftCarrierIn, kStft_Frame_Length);
+	arm_fill_f32(0, stftOverlap, kStft_Frame_Length);
+	arm_fill_f32(0, stftOutput, kStft_Hop);
+	arm_fill_f32(0, stft->envelope, kStft_Max_Bands);
+	stft->hopFill = 0;
+}
+/*
+ * runStftFrame
+ *
+ * Processes one STFT frame, once every kStft_Hop CODEC frames:
+ * transforms the windowed voice and carrier, follows the voice's
+ * magnitude in each band, scales the carrier's bins by it, and
+ * overlap-adds the result. The next hop of output is left in stftOutput.
+ *
+ * The band loop only touches each bin once, so the cost barely
+ * moves with the band count; the three FFTs dominate.
+ */
+void runStftFrame(stftVocoder *stft) {
+
+	arm_mult_f32(stftVoiceIn, stftWindow, stftWork, kStft_Frame_Length);
+	arm_rfft_fast_f32(&stft->fft, stftWork, stftVoiceSpectrum, 0);
+
+	arm_mult_f32(stftCarrierIn, stftWindow, stftWork, kStft_Frame_Length);
+	arm_rfft_fast_f32(&stft->fft, stftWork, stftCarrierSpectrum, 0);
+
+	/*
+	 * The packed spectrum keeps DC in [0], Nyquist in [1], and
+	 * bin k as (re, im) in [2k], [2k+1]. Neither DC nor Nyquist
+	 * falls in a band.
+	 */
+	stftCarrierSpectrum[0] = 0;
+	stftCarrierSpectrum[1] = 0;
+	arm_fill_f32(0, &stftCarrierSpectrum[2], 2 * (stft->bandEdge[0] - 1));
+
+	for(uint32_t b = 0; b < stft->numBands; b++) {
+
+		uint32_t lo = stft->bandEdge[b], count = 2 * (stft->bandEdge[b + 1] - lo);
+		float power, magnitude;
+
+		arm_power_f32(&stftVoiceSpectrum[2 * lo], count, &power);
+		arm_sqrt_f32(power, &magnitude);
+		stft->envelope[b] += STFT_ENVELOPE_SMOOTHING * (magnitude * stft->envelopeScale - stft->envelope[b]);
+
+		arm_scale_f32(&stftCarrierSpectrum[2 * lo], stft->envelope[b] * VOCODER_MIX_GAIN, &stftCarrierSpectrum[2 * lo], count);
+	}
+
+	/* Blank the gap above the bands, then pass the voice's sibilance through */
+	uint32_t top = stft->bandEdge[stft->numBands];
+	arm_fill_f32(0, &stftCarrierSpectrum[2 * top], 2 * (stft->sibilanceBin - top));
+	arm_copy_f32(&stftVoiceSpectrum[2 * stft->sibilanceBin], &stftCarrierSpectrum[2 * stft->sibilanceBin],
+			2 * (kStft_Bins - stft->sibilanceBin));
+
+	arm_rfft_fast_f32(&stft->fft, stftCarrierSpectrum, stftWork, 1);
+
+	/* Window again and overlap-add; the first hop is now complete */
+	arm_mult_f32(stftWork, stftWindow, stftWork, kStft_Frame_Length);
+	arm_add_f32(stftOverlap, stftWork, stftOverlap, kStft_Frame_Length);
+	arm_copy_f32(stftOverlap, stftOutput, kStft_Hop);
+
+	/* Slide everything along by a hop */
+	arm_copy_f32(&stftOverlap[kStft_Hop], stftOverlap, kStft_Frame_Length - kStft_Hop);
+	arm_fill_f32(0, &stftOverlap[kStft_Frame_Length - kStft_Hop], kStft_Hop);
+	arm_copy_f32(&stftVoiceIn[kStft_Hop], stftVoiceIn, kStft_Frame_Length - kStft_Hop);
+	arm_copy_f32(&stftCarrierIn[kStft_Hop], stftCarrierIn, kStft_Frame_Length - kStft_Hop);
+}
+/*
+ * processStftBlock
+ *
+ * The STFT engine's counterpart to processAudioBlock. Gathers the
+ * voice and the rendered synth into the current hop while playing
+ * out the last hop's result, and runs a frame whenever a hop fills.
+ *
+ * in and out hold interleaved {left, right} frames of 24-bit audio;
+ * frames must not exceed kAudio_Block_Frames.
+ */
+void processStftBlock(stftVocoder *stft, const int32_t *in, int32_t *out, size_t frames) {
+
+	int32_t synthOut[kAudio_Block_Frames];
+
+	assert(frames <= kAudio_Block_Frames);
+
+	playScheduledSynthBlock(&g_demoSynth, &g_midiSchedule, synthOut, frames);
+
+	for(uint32_t n = 0; n < frames; ++n) {
+
+		uint32_t pos = kStft_Frame_Length - kStft_Hop + stft->hopFill;
+
+		stftVoiceIn[pos] = (float)in[n * kAudio_Buffer_Words + 1]; // The mic sits on the right channel
+		stftCarrierIn[pos] = (float)synthOut[n];
+
+		out[n * kAudio_Buffer_Words] = (int32_t)stftOutput[stft->hopFill];
+		out[n * kAudio_Buffer_Words + 1] = out[n * kAudio_Buffer_Words];
+
+		if(++stft->hopFill >= kStft_Hop) {
+			runStftFrame(stft);
+			stft->hopFill = 0;
+		}
+	}
+}
+/*
+ * convertBiquadCoeffsQ31
+ *
+ * Converts a float[5] array of coefficients, as made by
+ * calculateBiquadCoeffs, to the CMSIS Q31 layout: half scale (see
+ * kFixed_Post_Shift), with the feedback terms negated. The numerator
+ * is scaled by gain on the way.
+ */
+void convertBiquadCoeffsQ31(const float *coeffs, float gain, q31_t *fixedCoeffs) {
+
+	float scaled[5];
+	float half = 1.0f / (1U << kFixed_Post_Shift);
+
+	scaled[0] = coeffs[0] * gain * half;
+	scaled[1] = coeffs[1] * gain * half;
+	scaled[2] = coeffs[2] * gain * half;
+	scaled[3] = -coeffs[3] * half;
+	scaled[4] = -coeffs[4] * half;
+
+	arm_float_to_q31(scaled, fixedCoeffs, 5);
+}
+/*
+ * toFixedSample
+ *
+ * Shifts a 24-bit sample up to Q31, clipping anything too wide
+ * to fit and counting it in saturations.
+ */
+q31_t toFixedSample(int32_t sample, uint32_t *saturations) {
+
+	if(sample > (INT32_MAX >> kFixed_Input_Shift)) {
+		(*saturations)++;
+		return INT32_MAX;
+	}
+	if(sample < (INT32_MIN >> kFixed_Input_Shift)) {
+		(*saturations)++;
+		return INT32_MIN;
+	}
+
+	return sample * (1 << kFixed_Input_Shift);
+}
+/*
+ * initFixedVocoder
+ *
+ * Converts the voice decimator and the sibilance filter to Q31,
+ * lays out the bands of cfg (see setFixedBands), and starts the
+ * engine from silence. The float coefficients must already have
+ * been calculated.
+ */
+void initFixedVocoder(fixedVocoder *fx, const vocoderConfig *cfg) {
+
+	arm_float_to_q31(voxDecimatorCoeffs, fixedDecimatorCoeffs, kVoxDecimator_Taps);
+
+	convertBiquadCoeffsQ31(sibilanceBiquadCoeffs, 1.0f, fixedSibilanceCoeffs);
+	arm_biquad_cas_df1_32x64_init_q31(&fx->sibilance, 1, fixedSibilanceCoeffs, fixedSibilanceState, kFixed_Post_Shift);
+
+	fx->numBands = 0;
+	setFixedBands(fx, cfg);
+	resetFixedVocoder(fx);
+}
+/*
+ * setFixedBands
+ *
+ * Takes up the band layout of cfg: its analysis filters, and its
+ * shaping filters recalculated for the full rate. The envelope
+ * followers take VOCODER_MIX_GAIN and the band's output gain, scaled
+ * to suit kFixed_Mix_Shift.
+ *
+ * Bands already running are retuned in place, keeping their filter
+ * state and envelope, so a commit while the engine is live carries on
+ * from where the bands were rather than ringing up from silence. Only
+ * bands new to the layout start from zero. The voice decimator and
+ * sibilance filter don't depend on the bands, and are left alone.
+ *
+ * Call from the program loop.
+ */
+void setFixedBands(fixedVocoder *fx, const vocoderConfig *cfg) {
+
+	float coeffs[5];
+	float mixGain = VOCODER_MIX_GAIN * (float)(1U << (kFixed_Mix_Shift - 2 * kFixed_Input_Shift));
+	uint32_t running = fx->numBands;
+
+	for(uint32_t b = 0; b < cfg->numBands; b++) {
+
+		convertBiquadCoeffsQ31(&cfg->analysisCoeffs[b * 5], 1.0f, &fixedAnalysisCoeffs[b * 5]);
+		convertBiquadCoeffsQ31(envelopeFollowerCoeffs, mixGain * cfg->outputGain[b], &fixedFollowerCoeffs[b * 5]);
+
+		calculateBiquadCoeffs(coeffs, cfg->f0[b], (float)kAudio_Frame_Hz, kFilter_Band_Pass, cfg->shapingBW[b]);
+		convertBiquadCoeffsQ31(coeffs, 1.0f, &fixedShapingCoeffs[b * 5]);
+
+		/* The kernels already point at the coefficients just rewritten; only new bands need setting up, which clears their state */
+		if(b >= running) {
+			arm_biquad_cas_df1_32x64_init_q31(&fx->analysis[b], 1, &fixedAnalysisCoeffs[b * 5], fixedAnalysisStates[b], kFixed_Post_Shift);
+			arm_biquad_cas_df1_32x64_init_q31(&fx->follower[b], 1, &fixedFollowerCoeffs[b * 5], fixedFollowerStates[b], kFixed_Post_Shift);
+			arm_biquad_cas_df1_32x64_init_q31(&fx->shaping[b], 1, &fixedShapingCoeffs[b * 5], fixedShapingStates[b], kFixed_Post_Shift);
+			fx->envelope[b] = 0;
+		}
+	}
+
+	fx->numBands = cfg->numBands;
+}
+/*
+ * resetFixedVocoder
+ *
+ * Clears the filter state, envelopes and saturation counts
+ * of the Q31 engine.
+ */
+void resetFixedVocoder(fixedVocoder *fx) {
+
+	arm_fir_decimate_init_q31(&fx->decimator, kVoxDecimator_Taps, kResample_Downsample_Rate,
+			fixedDecimatorCoeffs, fixedDecimatorState, kVoxDecimator_Max_Input);
+	fx->decimatorCarryCount = 0;
+
+	memset(fixedSibilanceState, 0, sizeof(fixedSibilanceState));
+	memset(fixedAnalysisStates, 0, sizeof(fixedAnalysisStates));
+	memset(fixedFollowerStates, 0, sizeof(fixedFollowerStates));
+	memset(fixedShapingStates, 0, sizeof(fixedShapingStates));
+	memset(fx->envelope, 0, sizeof(fx->envelope));
+
+	fx->inputSaturations = 0;
+	fx->mixSaturations = 0;
+	fx->outputSaturations = 0;
+}
+/*
+ * processFixedBlock
+ *
+ * The Q31 engine's counterpart to processAudioBlock. Runs each band
+ * in turn, from analysis through shaping, adding it into a 64-bit mix
+ * under its envelope, which is held over each tick's segment. The mix
+ * can't wrap (see kFixed_Band_Headroom), so mixSaturations sees every
+ * sum too wide for Q31.
+ *
+ * in and out hold interleaved {left, right} frames of 24-bit audio;
+ * frames must not exceed kAudio_Block_Frames.
+ */
+void processFixedBlock(fixedVocoder *fx, const int32_t *in, int32_t *out, size_t frames) {
+
+	int32_t synthOut[kAudio_Block_Frames];
+	q31_t downsampled[kVocoder_Max_Block_Ticks];
+	q31_t envelopes[kVocoder_Max_Block_Ticks + 1];
+	uint32_t segmentStart[kVocoder_Max_Block_Ticks + 2];
+
+	uint32_t carried = fx->decimatorCarryCount;
+	uint32_t staging = carried + frames;
+	uint32_t ticks = staging / kResample_Downsample_Rate;
+	uint32_t used = ticks * kResample_Downsample_Rate;
+
+	assert(frames <= kAudio_Block_Frames);
+
+	playScheduledSynthBlock(&g_demoSynth, &g_midiSchedule, synthOut, frames);
+
+	/* The mic sits on the right channel, after the frames the decimator carried over */
+	arm_copy_q31(fx->decimatorCarry, fixedVoice, carried);
+	for(uint32_t n = 0; n < frames; ++n) {
+		fixedVoice[carried + n] = toFixedSample(in[n * kAudio_Buffer_Words + 1], &fx->inputSaturations);
+		fixedCarrier[n] = toFixedSample(synthOut[n], &fx->inputSaturations);
+		fixedMix[n] = 0;
+	}
+
+	if(ticks) {
+		arm_fir_decimate_q31(&fx->decimator, fixedVoice, downsampled, used);
+	}
+	fx->decimatorCarryCount = staging - used;
+	arm_copy_q31(&fixedVoice[used], fx->decimatorCarry, fx->decimatorCarryCount);
+	setTickSegments(segmentStart, ticks, carried, frames);
+
+	arm_biquad_cas_df1_32x64_q31(&fx->sibilance, &fixedVoice[carried], fixedSibilance, frames);
+
+	for(uint32_t b = 0; b < fx->numBands; ++b) {
+
+		/* Segment 0 keeps the envelope left over from the last block */
+		envelopes[0] = fx->envelope[b];
+		if(ticks) {
+			arm_biquad_cas_df1_32x64_q31(&fx->analysis[b], downsampled, fixedBand, ticks);
+			arm_abs_q31(fixedBand, fixedBand, ticks);
+			arm_biquad_cas_df1_32x64_q31(&fx->follower[b], fixedBand, &envelopes[1], ticks);
+			fx->envelope[b] = envelopes[ticks];
+		}
+
+		arm_biquad_cas_df1_32x64_q31(&fx->shaping[b], fixedCarrier, fixedBand, frames);
+
+		for(uint32_t seg = 0; seg <= ticks; ++seg) {
+			q63_t gain = envelopes[seg];
+			for(uint32_t n = segmentStart[seg]; n < segmentStart[seg + 1]; ++n) {
+				fixedMix[n] += ((q63_t)fixedBand[n] * gain) >> kFixed_Band_Headroom;
+			}
+		}
+	}
+
+	/* Modulated synth plus the consonants, back down to 24 bits */
+	for(uint32_t n = 0; n < frames; ++n) {
+
+		q63_t vocoded = fixedMix[n] >> (kFixed_Mix_Shift - kFixed_Band_Headroom);
+		if(vocoded > INT32_MAX || vocoded < INT32_MIN) {
+			fx->mixSaturations++;
+			vocoded = clip_q63_to_q31(vocoded);
+		}
+
+		q63_t sample = vocoded + (fixedSibilance[n] >> kFixed_Input_Shift);
+		if(sample > kFixed_Output_Max || sample < kFixed_Output_Min) {
+			fx->outputSaturations++;
+			sample = (sample > 0) ? kFixed_Output_Max : kFixed_Output_Min;
+		}
+
+		out[n * kAudio_Buffer_Words] = (int32_t)sample;
+		out[n * kAudio_Buffer_Words + 1] = out[n * kAudio_Buffer_Words];
+	}
+}
+/*
+ * setVocoderEngine
+ *
+ * Selects the engine processAudioBlock runs. Call from the program
+ * loop, between blocks. The STFT and Q31 engines start over from
+ * silence each time they are switched in.
+ */
+void setVocoderEngine(vocoder_engine_t engine) {
+
+	if(engine == g_vocoderEngine) return;
+
+	if(engine == kVocoder_Engine_Stft) resetStftVocoder(&g_stftVocoder);
+	if(engine == kVocoder_Engine_Fixed) resetFixedVocoder(&g_fixedVocoder);
+	g_vocoderEngine = engine;
+}
+/*
+ * getVocoderLatencyFrames
+ *
+ * Returns the delay, in CODEC frames, the selected engine adds to
+ * the audio path on top of the block FIFO. The biquad engine's
+ * octave tree adds kVocoder_Align_Delay; the STFT holds everything
+ * back one frame. The Q31 engine shapes at the full rate and adds none.
+ */
+uint32_t getVocoderLatencyFrames(void) {
+
+	if(g_vocoderEngine == kVocoder_Engine_Stft) return kStft_Frame_Length;
+	if(g_vocoderEngine == kVocoder_Engine_Fixed) return 0;
+
+	return kVocoder_Align_Delay;
+}
+
+#if SPEAKEZ_BENCHMARK
+/*
+ * runShapingReferenceBlock
+ *
+ * The scalar shaping filters the bank replaced: direct form I,
+ * one band at a time, shifting the history each sample.
+ * Only used as the benchmark's baseline.
+ */
+void runShapingReferenceBlock(const float *newInputs, uint32_t frames, float *coeffs) {
+
+	float x1Start = shapingReferenceInputs[0], x2Start = shapingReferenceInputs[1];
+
+	for(uint32_t i = 0; i < NUM_VOCODER_BANDS; ++i) {
+
+		float b0 = coeffs[5 * i], b2 = coeffs[5 * i + 2], a1 = coeffs[5 * i + 3], a2 = coeffs[5 * i + 4];
+		float x1 = x1Start, x2 = x2Start;
+		float y1 = shapingReferenceOutputs[i][0], y2 = shapingReferenceOutputs[i][1];
+		float *bandOut = shapingReferenceBlock[i];
+
+		for(uint32_t n = 0; n < frames; ++n) {
+
+			float x0 = newInputs[n];
+			float y0 = b0 * x0 + b2 * x2 - a1 * y1 - a2 * y2;
+
+			x2 = x1;
+			x1 = x0;
+			y2 = y1;
+			y1 = y0;
+
+			bandOut[n] = y0;
+		}
+
+		shapingReferenceOutputs[i][0] = y1;
+		shapingReferenceOutputs[i][1] = y2;
+	}
+
+	for(uint32_t n = 0; n < frames; ++n) {
+		shapingReferenceInputs[1] = shapingReferenceInputs[0];
+		shapingReferenceInputs[0] = newInputs[n];
+	}
+}
+/*
+ * runBenchmarks
+ *
+ * Times each DSP stage over BENCHMARK_BLOCKS blocks of noise with the
+ * DWT cycle counter and prints the cycles spent per CODEC frame.
+ * At 500 MHz and 46.88 kHz the whole chain has about 10600 to spend.
+ *
+ * Call before the CODEC starts; filter state is reset afterwards.
+ */
+void runBenchmarks(void) {
+
+	float noise[kAudio_Block_Frames];
+	int32_t fixedIn[kAudio_Block_Words], fixedOut[kAudio_Block_Words];
+	uint32_t seed = 1;
+	uint32_t start, cycles;
+	vocoderConfig *cfg = &g_vocoderConfigs[g_activeVocoderConfig];
+
+	for(uint32_t n = 0; n < kAudio_Block_Frames; ++n) {
+		seed = seed * 1664525U + 1013904223U;
+		noise[n] = (float)((int32_t)seed >> 8);
+	}
+
+	enableCycleCounter();
+
+	for(uint32_t band = 0; band < NUM_VOCODER_BANDS; ++band) {
+		calculateBiquadCoeffs(&shapingReferenceCoeffs[band * 5], bandpassBiquadF0[band],
+				(float)kAudio_Frame_Hz, kFilter_Band_Pass, shapingBiquadBWs[band]);
+	}
+
+	PRINTF("Benchmarking, cycles per frame:\n");
+
+	start = DWT->CYCCNT;
+	for(uint32_t b = 0; b < BENCHMARK_BLOCKS; ++b) {
+		runShapingReferenceBlock(noise, kAudio_Block_Frames, shapingReferenceCoeffs);
+	}
+	cycles = DWT->CYCCNT - start;
+	PRINTF("  shaping, scalar DF1, %d bands: %d\n", NUM_VOCODER_BANDS, cycles / (BENCHMARK_BLOCKS * kAudio_Block_Frames));
+
+	start = DWT->CYCCNT;
+	for(uint32_t b = 0; b < BENCHMARK_BLOCKS; ++b) {
+		splitCarrierOctaves(noise, kAudio_Block_Frames);
+		for(uint32_t level = 0; level < kVocoder_Rate_Levels; ++level) {
+			runShapingBiquadBlock(carrierLevels[level], kAudio_Block_Frames >> level, &cfg->shaping,
+					cfg->levelFirstBand[level], cfg->levelFirstBand[level + 1]);
+		}
+	}
+	cycles = DWT->CYCCNT - start;
+	PRINTF("  shaping, octave tree, %d bands: %d\n", cfg->numBands, cycles / (BENCHMARK_BLOCKS * kAudio_Block_Frames));
+
+	/* Each follower runs kVocoder_Max_Block_Ticks ticks, standing for that many downsamples of frames */
+	runAnalysisBiquadBlock(cfg, noise, vocoderAnalysisAbs, kVocoder_Max_Block_Ticks);
+	start = DWT->CYCCNT;
+	for(uint32_t b = 0; b < BENCHMARK_BLOCKS; ++b) {
+		runEnvelopeFollowerBlock(cfg, vocoderAnalysisAbs, vocoderEnvelopes, kVocoder_Max_Block_Ticks, envelopeFollowerCoeffs);
+	}
+	cycles = DWT->CYCCNT - start;
+	PRINTF("  envelopes, biquad, %d bands: %d\n", cfg->numBands,
+			cycles / (BENCHMARK_BLOCKS * kVocoder_Max_Block_Ticks * kResample_Downsample_Rate));
+
+	for(uint32_t type = kFollower_Attack_Release; type <= kFollower_Peak_Hold; ++type) {
+
+		envelopeFollower follower = g_envelopeFollower;
+		follower.type = (follower_type_t)type;
+
+		start = DWT->CYCCNT;
+		for(uint32_t b = 0; b < BENCHMARK_BLOCKS; ++b) {
+			runAttackReleaseFollowerBlock(cfg, vocoderAnalysisAbs, vocoderEnvelopes, kVocoder_Max_Block_Ticks, &follower);
+		}
+		cycles = DWT->CYCCNT - start;
+		PRINTF("  envelopes, %s, %d bands: %d\n", (type == kFollower_Peak_Hold) ? "peak hold" : "attack/release",
+				cfg->numBands, cycles / (BENCHMARK_BLOCKS * kVocoder_Max_Block_Ticks * kResample_Downsample_Rate));
+	}
+
+	for(uint32_t n = 0; n < kAudio_Block_Frames; ++n) {
+		fixedIn[n * kAudio_Buffer_Words] = 0;
+		fixedIn[n * kAudio_Buffer_Words + 1] = (int32_t)noise[n];
+	}
+	start = DWT->CYCCNT;
+	for(uint32_t b = 0; b < BENCHMARK_BLOCKS; ++b) {
+		processFixedBlock(&g_fixedVocoder, fixedIn, fixedOut, kAudio_Block_Frames);
+	}
+	cycles = DWT->CYCCNT - start;
+	PRINTF("  Q31 engine, %d bands, with synth: %d\n", g_fixedVocoder.numBands, cycles / (BENCHMARK_BLOCKS * kAudio_Block_Frames));
+
+	for(uint32_t n = 0; n < kStft_Frame_Length; ++n) {
+		stftVoiceIn[n] = noise[n % kAudio_Block_Frames];
+		stftCarrierIn[n] = noise[(n + 7) % kAudio_Block_Frames];
+	}
+	start = DWT->CYCCNT;
+	for(uint32_t b = 0; b < BENCHMARK_BLOCKS; ++b) {
+		runStftFrame(&g_stftVocoder);
+	}
+	cycles = DWT->CYCCNT - start;
+	PRINTF("  STFT engine, %d bands: %d\n", g_stftVocoder.numBands, cycles / (BENCHMARK_BLOCKS * kStft_Hop));
+
+	initCarrierOctaves();
+	buildVocoderConfig(cfg);
+	resetStftVocoder(&g_stftVocoder);
+	resetFixedVocoder(&g_fixedVocoder);
+}
+#endif
+
+
+/*
+ * SAI1_RxDmaCallback
+ *
+ * Called from the Rx eDMA interrupt at the half and full points
+ * of the circular Rx buffer, once per block of kAudio_Block_Frames.
+ *
+ * The remaining major loop count tells us which half the DMA has
+ * moved on to; the other half is complete. It is pushed onto
+ * g_rxAudioFifo, and the matching Tx half is refilled from
+ * g_txAudioFifo (or silence, if the program loop fell behind).
+ *
+ * This ticks the audio block heartbeat of the application, and the
+ * frame clock that MIDI events are timed against.
+ */
+void SAI1_RxDmaCallback(edma_handle_t *handle, void *userData, bool transferDone, uint32_t tcds) {
+
+	(void)userData;
+	(void)transferDone;
+	(void)tcds;
+
+	uint32_t remaining = EDMA_GetRemainingMajorLoopCount(handle->base, handle->channel);
+	uint32_t frameCount = g_audioFrameCount + kAudio_Block_Frames;
+
+	g_audioFrameCount = frameCount;
+
+	// More than a block left to go means the DMA has wrapped into the first half
+	uint32_t readyHalf = (remaining > kAudio_Block_Frames) ? 1U : 0U;
+	int32_t *rxHalf = &SAI1_rxDmaBuffer[readyHalf * kAudio_Block_Words];
+	int32_t *txHalf = &SAI1_txDmaBuffer[readyHalf * kAudio_Block_Words];
+
+	int32_t *rxBlock = audioFifoWriteSlot(&g_rxAudioFifo);
+	if(rxBlock != NULL) {
+		for(int ii = 0; ii < kAudio_Block_Words; ii++) {
+			rxBlock[ii] = rxHalf[ii] / 256; // sign-agnostic right-shift
+		}
+		g_rxAudioFifo.endFrame[g_rxAudioFifo.head & (kAudio_Fifo_Blocks - 1)] = frameCount;
+		audioFifoPublish(&g_rxAudioFifo);
+	}
+	else g_rxAudioFifo.overruns++;
+
+	int32_t *txBlock = audioFifoReadSlot(&g_txAudioFifo);
+	if(txBlock != NULL) {
+		for(int ii = 0; ii < kAudio_Block_Words; ii++) {
+			txHalf[ii] = txBlock[ii] * 256; // sign-agnostic left-shift
+		}
+		audioFifoRelease(&g_txAudioFifo);
+	}
+	else {
+		for(int ii = 0; ii < kAudio_Block_Words; ii++) {
+			txHalf[ii] = 0;
+		}
+		g_txAudioFifo.underruns++;
+	}
+
+	// Lastly, clear any halting status flags
+	SAI_RxClearStatusFlags(SAI_1_PERIPHERAL, kSAI_WordStartFlag | kSAI_FIFOErrorFlag);
+	SAI_TxClearStatusFlags(SAI_1_PERIPHERAL, kSAI_WordStartFlag | kSAI_FIFOErrorFlag);
+
+}
+/*
+ * getAudioFrameTime
+ *
+ * Returns the number of frames the SAI has captured, to the frame:
+ * g_audioFrameCount plus how far the Rx DMA is into the block under way.
+ *
+ * Each Rx interrupt moves the DMA on to the other half of its buffer, so
+ * the half it is in should follow from the block count. If not, the DMA
+ * has crossed into the next half and its interrupt is still pending.
+ */
+uint32_t getAudioFrameTime(void) {
+
+	uint32_t frames;
+	uint32_t position;
+
+	do {
+		frames = g_audioFrameCount;
+		position = 2 * kAudio_Block_Frames - EDMA_GetRemainingMajorLoopCount(DMA0, SAI1_RX_DMA_CHANNEL);
+	} while(frames != g_audioFrameCount);
+
+	position %= 2 * kAudio_Block_Frames;
+	if((position / kAudio_Block_Frames) != ((frames / kAudio_Block_Frames) & 1U)) frames += kAudio_Block_Frames;
+
+	return frames + position % kAudio_Block_Frames;
+}
+/*
+ * getMidiArrivalTime
+ *
+ * The clock the MIDI ring stamps received transfers with: the frame
+ * time latched at the USB interrupt that completed them. If another
+ * transfer completes before the USB task gets to the first, both carry
+ * the later time.
+ */
+uint32_t getMidiArrivalTime(void) {
+
+	return g_usbTransferDoneTime;
+}
+/*
+ * DMA0_IRQHandler
+ *
+ * Rx audio eDMA channel interrupt, routed through the SDK handle
+ * so SAI1_RxDmaCallback sees a cleared interrupt flag.
+ */
+void DMA0_IRQHandler(void) {
+
+	EDMA_HandleIRQ(&g_SAI1_rxDmaHandle);
+
+}
+
+
+/*
+ * PIT_IRQHandler
+ *
+ * Used to digitally debounce the SW4 input.
+ * Necessary to ensure each press and release results
  * in only ONE press event.
  *
  * Somewhat less expensive than constantly checking in the main while().
@@ -1068,6 +3148,9 @@ void USB_HostApplicationInit(void)
     SYSMPU_Enable(SYSMPU, 0);
 #endif /* FSL_FEATURE_SOC_SYSMPU_COUNT */
 
+    USB_HostMidiRingInit(&g_demoMidiEventQueue, g_demoMidiEventPackets, g_demoMidiEventTimes,
+    		MIDI_EVENT_QUEUE_SIZE, getMidiArrivalTime);
+
     status = USB_HostInit(CONTROLLER_ID, &g_demoUSBHostHandle, USB_HostEvent);
     if (status != kStatus_USB_Success)
     {
@@ -1082,13 +3165,63 @@ void USB_HostApplicationInit(void)
 /*
  * USB_OTG1_IRQHandler
  *
- * Activates the EHCI IRQ Handler on USB OTG interrupts.
+ * Activates the EHCI IRQ Handler on USB OTG interrupts, latching the
+ * frame time first if a transfer has completed, before the handler
+ * clears the status.
  * REQUIRES A GLOBAL usb_host_handle OBJECT.
  */
 void USB_OTG1_IRQHandler(void) {
+    if(USB->USBSTS & USB->USBINTR & USB_USBSTS_UI_MASK) {
+        g_usbTransferDoneTime = getAudioFrameTime();
+    }
     USB_HostEhciIsrFunction(g_demoUSBHostHandle);
 }
 
+/*
+ * handleControlChange
+ *
+ * Acts on a MIDI control change on the synth's channel.
+ * Times map exponentially across their FOLLOWER_*_MS ranges,
+ * except the hold time, which is linear from zero.
+ */
+void handleControlChange(uint8_t controller, uint8_t value) {
+
+	envelopeFollower *follower = &g_envelopeFollower;
+	float position = (float)value / 127.0f;
+
+	switch(controller) {
+	case kCC_Follower_Attack:
+		setEnvelopeFollower(follower, follower->type,
+				FOLLOWER_ATTACK_MIN_MS * powf(FOLLOWER_ATTACK_MAX_MS / FOLLOWER_ATTACK_MIN_MS, position),
+				follower->releaseMs, follower->holdMs);
+		break;
+	case kCC_Follower_Release:
+		setEnvelopeFollower(follower, follower->type, follower->attackMs,
+				FOLLOWER_RELEASE_MIN_MS * powf(FOLLOWER_RELEASE_MAX_MS / FOLLOWER_RELEASE_MIN_MS, position),
+				follower->holdMs);
+		break;
+	case kCC_Follower_Hold:
+		setEnvelopeFollower(follower, follower->type, follower->attackMs, follower->releaseMs,
+				FOLLOWER_HOLD_MAX_MS * position);
+		break;
+	case kCC_Follower_Type:
+		setEnvelopeFollower(follower, (follower_type_t)(value / 43), follower->attackMs,
+				follower->releaseMs, follower->holdMs);
+		break;
+	case kCC_Vad_Mode:
+		g_vad.mode = (vad_mode_t)(value / 32);
+		break;
+	case kCC_Sibilance_Mode:
+		g_voicing.mode = (sibilance_mode_t)(value / 43);
+		break;
+	case kCC_Load_Report:
+		g_audioLoad.reportPending = 1;
+		break;
+	default:
+		break;
+	}
+}
+
 /*
  * handleMidiEventPacket
  *
@@ -1098,6 +3231,7 @@ void USB_OTG1_IRQHandler(void) {
  * Confirms the associated channel number.
  * Presses or releases keys, using MIDI commands "Note_On" and "Note_Off".
  * Updates channel pitchbend.
+ * Passes control changes to handleControlChange.
  * Future functionality pending...
  */
 void handleMidiEventPacket(wavetableSynth *synth, usbmidi_event_packet_t event) {
@@ -1140,6 +3274,7 @@ void handleMidiEventPacket(wavetableSynth *synth, usbmidi_event_packet_t event)
 	case kUSBMIDI_CIN_Poly_Keypress:
 		break;
 	case kUSBMIDI_CIN_Control_Change:
+		handleControlChange(eventByte1, eventByte2);
 		break;
 	case kUSBMIDI_CIN_Program_Change:
 		break;
@@ -1155,6 +3290,107 @@ void handleMidiEventPacket(wavetableSynth *synth, usbmidi_event_packet_t event)
 	}
 
 }
+/*
+ * scheduleMidiEvent
+ *
+ * Inserts event into the schedule at offset, behind any events already
+ * at that frame so they keep their arrival order. Events mostly arrive
+ * in time order, so the search from the back is usually one step, and
+ * never more than kMidi_Schedule_Events.
+ *
+ * Returns 0 if the schedule is full.
+ */
+_Bool scheduleMidiEvent(midiSchedule *schedule, usbmidi_event_packet_t event, uint32_t offset) {
+
+	if(schedule->count >= kMidi_Schedule_Events) return 0;
+
+	uint32_t i = schedule->count++;
+	while(i > 0 && schedule->offset[i - 1] > offset) {
+		schedule->event[i] = schedule->event[i - 1];
+		schedule->offset[i] = schedule->offset[i - 1];
+		i--;
+	}
+	schedule->event[i] = event;
+	schedule->offset[i] = offset;
+
+	return 1;
+}
+/*
+ * scheduleMidiBlock
+ *
+ * Takes the events due in the block of frames starting at frame time
+ * blockStart off queue, and schedules them at their offsets into it.
+ *
+ * An event received after the block's capture window stays held for a
+ * later block. One received before it was due in a block already played,
+ * so goes at frame 0. Events are stamped when their transfer completes,
+ * and the USB task is run before each block is scheduled, so every event
+ * received within the window is on the queue by then and this adds no
+ * delay.
+ */
+void scheduleMidiBlock(midiSchedule *schedule, usb_host_midi_packet_ring_t *queue, uint32_t blockStart, uint32_t frames) {
+
+	usbmidi_event_packet_t event;
+	uint32_t time;
+
+	schedule->count = 0;
+
+	while(1) {
+
+		if(schedule->held) {
+			event = schedule->heldEvent;
+			time = schedule->heldTime;
+		}
+		else if(!midiQueuePop(queue, &event, &time)) break;
+
+		int32_t offset = (int32_t)(time - blockStart);	// wraps with the frame clock
+
+		if(offset >= (int32_t)frames) {
+			schedule->heldEvent = event;
+			schedule->heldTime = time;
+			schedule->held = 1;
+			break;
+		}
+		if(offset < 0) {
+			offset = 0;
+			schedule->late++;
+		}
+		if(!scheduleMidiEvent(schedule, event, offset)) {
+			schedule->heldEvent = event;
+			schedule->heldTime = blockStart + frames;
+			schedule->held = 1;
+			schedule->slipped++;
+			break;
+		}
+		schedule->held = 0;
+	}
+}
+/*
+ * playScheduledSynthBlock
+ *
+ * Renders a block of synth audio like playSynthBlock, stopping at each
+ * scheduled event's frame to apply it, so the change it makes is heard
+ * from that frame on. Empties the schedule.
+ */
+void playScheduledSynthBlock(wavetableSynth *synth, midiSchedule *schedule, int32_t *audioOut, uint32_t frames) {
+
+	uint32_t position = 0;
+
+	for(uint32_t i = 0; i < schedule->count; i++) {
+
+		uint32_t offset = schedule->offset[i];
+		if(offset > frames) offset = frames;
+
+		if(offset > position) {
+			playSynthBlock(synth, audioOut + position, offset - position);
+			position = offset;
+		}
+		handleMidiEventPacket(synth, schedule->event[i]);
+	}
+	if(frames > position) playSynthBlock(synth, audioOut + position, frames - position);
+
+	schedule->count = 0;
+}
 
 
 
@@ -1172,14 +3408,17 @@ int main(void) {
 
 
     PRINTF("Initializing wavetables...\n");
-    setWavetableSine(wavetableSine, kSynth_Table_Length);
-    setWavetableTri(wavetableTri, kSynth_Table_Length);
-    setWavetableSaw(wavetableSaw, kSynth_Table_Length);
-    setWavetableNovel(wavetableNovel, kSynth_Table_Length);
-
-    wavetableSynth demoSynth;
-    initSynth(&demoSynth, kSynth_Num_Keys, kSynth_A3_Index, TONE_A3_HZ, kUSBMIDI_Channel_1);
-    demoSynth.wavetable = &wavetableSaw[0];
+    setWavetableSine(wavetableNaive, kSynth_Table_Length);
+    buildWavetableMipmap(&wavetableSine, wavetableSineLevels, 1, wavetableNaive);
+    setWavetableTri(wavetableNaive, kSynth_Table_Length);
+    buildWavetableMipmap(&wavetableTri, wavetableTriLevels, kSynth_Mip_Levels, wavetableNaive);
+    setWavetableSaw(wavetableNaive, kSynth_Table_Length);
+    buildWavetableMipmap(&wavetableSaw, wavetableSawLevels, kSynth_Mip_Levels, wavetableNaive);
+    setWavetableNovel(wavetableNaive, kSynth_Table_Length);
+    buildWavetableMipmap(&wavetableNovel, wavetableNovelLevels, kSynth_Mip_Levels, wavetableNaive);
+
+    initSynth(&g_demoSynth, kSynth_Num_Keys, kSynth_A3_Index, TONE_A3_HZ, kUSBMIDI_Channel_1);
+    g_demoSynth.wavetable = &wavetableSaw;
     g_activeWavetable = 2;
 
     /*
@@ -1195,21 +3434,14 @@ int main(void) {
     _Bool funcToggled = 0;
     if(!GPIO_PinRead(BOARD_USER_BUTTON_GPIO, BOARD_USER_BUTTON_GPIO_PIN)) {
     	noMidiDemo = 1;
-    	playDemoChord(&demoSynth, g_activeDemoChord);
+    	playDemoChord(&g_demoSynth, g_activeDemoChord);
     }
 
 
     PRINTF("Initializing vocoder...\n");
 
-    float lowpassBiquadCoeffs[5] 						= {0};
-    float sibilanceBiquadCoeffs[5] 						= {0};
-    float analysisBiquadCoeffs[NUM_VOCODER_BANDS * 5]	= {0};
-    float envelopeFollowerCoeffs[5]						= {0};
-    float shapingBiquadCoeffs[NUM_VOCODER_BANDS * 5]	= {0};
-
-    /* calculate antialiasing filter coefficients */
-    calculateBiquadCoeffs(lowpassBiquadCoeffs, (float)kResample_Phoneme_LP,
-    		(float)kAudio_Frame_Hz, kFilter_Low_Pass, lowpassBiquadQ);
+    /* design the voice decimator */
+    initVoxDecimator();
 
     /* calculate sibilance filter coefficients */
     calculateBiquadCoeffs(sibilanceBiquadCoeffs, (float)kResample_Sibilance_HP,
@@ -1219,22 +3451,35 @@ int main(void) {
     calculateBiquadCoeffs(envelopeFollowerCoeffs, (float)kResample_Envelope_Freq,
     		(float)kAudio_Frame_Hz / 6, kFilter_Low_Pass, envelopeFollowerQ);
 
-    for(int band = 0; band < NUM_VOCODER_BANDS; band++) {
+    /* start on the biquad envelope follower, with the attack/release times ready */
+    setEnvelopeFollower(&g_envelopeFollower, kFollower_Biquad, 2.0f, 40.0f, 20.0f);
 
-    	/* calculate voice analysis filter coefficients per band */
-    	calculateBiquadCoeffs(&analysisBiquadCoeffs[band * 5], bandpassBiquadF0[band],
-    			(float)kAudio_Frame_Hz / 6, kFilter_Band_Pass, analysisBiquadBWs[band]);
+    /* design the half-band filters of the shaping octave tree */
+    initCarrierOctaves();
 
-    	/* calculate synth shaping filter coefficients per band */
-    	calculateBiquadCoeffs(&shapingBiquadCoeffs[band * 5], bandpassBiquadF0[band],
-    	    	(float)kAudio_Frame_Hz, kFilter_Band_Pass, shapingBiquadBWs[band]);
+    /* lay out the startup bands and calculate their filter coefficients */
+    vocoderConfig *startupBands = &g_vocoderConfigs[g_activeVocoderConfig];
+    setVocoderBands(startupBands, NUM_VOCODER_BANDS, bandpassBiquadF0, analysisBiquadBWs, shapingBiquadBWs);
+    buildVocoderConfig(startupBands);
 
-    }
+    /* The STFT engine covers the same span as the biquad bands */
+    initStftVocoder(&g_stftVocoder, startupBands->numBands, startupBands->minHz, startupBands->maxHz);
+
+    /* The Q31 engine runs the same bands in fixed point */
+    initFixedVocoder(&g_fixedVocoder, startupBands);
 
-    uint32_t voxDownsampleCount = 0;
-    float aaVoice = 0;
-    float sibilanceBypass = 0;
-    float summedAudio = 0;
+    /* Skip the band stage while nobody is speaking */
+    initVoiceActivity(&g_vad, kVad_Decay);
+
+    /* Only let the sibilance through on unvoiced sounds */
+    initVoicing(&g_voicing, kSibilance_Gated);
+
+    /* Time every audio block for the load meter */
+    enableCycleCounter();
+
+#if SPEAKEZ_BENCHMARK
+    runBenchmarks();
+#endif
 
 
     /*
@@ -1254,6 +3499,7 @@ int main(void) {
 
 
     PRINTF("Initializing SAI1...\n");
+    initAudioDma();
     SAI1->TCSR |= 0b1U << 29; // Enable debug SAI transfers
     SAI1->RCSR |= 0b1U << 29; // Enable debug SAI reads
     SAI_TxEnable(SAI_1_PERIPHERAL, 1);
@@ -1273,50 +3519,33 @@ int main(void) {
 
 
     	/* Play the synth, listen to the voice, and run the vocoder filters */
-        if(getSAI_RequestSynthUpdate()) {
-
-        	getRxAudio(inputAudioBuffer);
-
-        	aaVoice = runLowpassBiquad((float)inputAudioBuffer[1], lowpassBiquadCoeffs);				// Save the low-passed voice
-        	sibilanceBypass = runSibilanceBiquad((float)inputAudioBuffer[1], sibilanceBiquadCoeffs);	// Save the high-passed voice
-
-        	if(voxDownsampleCount == 0) {
-        		runAnalysisBiquad(aaVoice, analysisBiquadCoeffs);		// Capture the filtered amplitude from each downsampled voice band
-        	}
-        	if(voxDownsampleCount == 1) {
-        		runEnvelopeFollower(analysisBiquadAbs, envelopeFollowerCoeffs); // Run the follower one sample delayed for performance reasons
-        	}
-
-        	runShapingBiquad((float)playSynth(&demoSynth), shapingBiquadCoeffs);	// Capture the filtered amplitude from each synth band
-
-        	summedAudio = 0;
-        	for(int i = 0; i < NUM_VOCODER_BANDS; ++i) {
-        		summedAudio += shapingBiquadOutputs[i][0] * envelopeFollowerOutputs[i][0] * 0.00005; 	// Modulate the synth data
+        int32_t *rxBlock;
+        int32_t *txBlock;
+        while(((rxBlock = audioFifoReadSlot(&g_rxAudioFifo)) != NULL) &&
+        	  ((txBlock = audioFifoWriteSlot(&g_txAudioFifo)) != NULL)) {
+
+        	/* MIDI events received while this block was captured play at the same frames */
+        	if(!noMidiDemo) {
+        		USB_HostTaskFn(g_demoUSBHostHandle);	// puts the transfers completed so far on the queue
+        		uint32_t blockEnd = g_rxAudioFifo.endFrame[g_rxAudioFifo.tail & (kAudio_Fifo_Blocks - 1)];
+        		scheduleMidiBlock(&g_midiSchedule, &g_demoMidiEventQueue, blockEnd - kAudio_Block_Frames, kAudio_Block_Frames);
         	}
-        	summedAudio += sibilanceBypass;															// Add in consonants from speech
-
-        	outputAudioBuffer[0] = (int32_t)summedAudio;
-        	outputAudioBuffer[1] = outputAudioBuffer[0];
-
-        	setTxAudio(outputAudioBuffer);
 
-        	if(++voxDownsampleCount >= kResample_Downsample_Rate) {
-        		voxDownsampleCount = 0;
-        	}
+        	uint32_t blockStart = DWT->CYCCNT;
+        	processAudioBlock(rxBlock, txBlock, kAudio_Block_Frames);
+        	updateAudioLoadMeter(&g_audioLoad, DWT->CYCCNT - blockStart, kAudio_Block_Frames);
 
-        	clearSAI_RequestSynthUpdate();
+        	audioFifoRelease(&g_rxAudioFifo);
+        	audioFifoPublish(&g_txAudioFifo);
         }
 
+        if(g_audioLoad.reportPending) reportAudioLoad(&g_audioLoad);
+
 
         /* Handle USB events and parse received packets/data */
         if(!noMidiDemo){
         	USB_HostTaskFn(g_demoUSBHostHandle);
         	USB_HostMidiTask(&g_demoMidiInstance);
-
-        	if(g_demoMidiPacketRecvFlag) {
-        		handleMidiEventPacket(&demoSynth, g_demoMidiEventPacket);
-        		g_demoMidiPacketRecvFlag = 0;
-        	}
         }
 
 
@@ -1325,8 +3554,8 @@ int main(void) {
 
         	USER_LED_ON();
 
-        	if(noMidiDemo) toggleDemoChord(&demoSynth);
-        	else toggleActiveWavetable(&demoSynth);
+        	if(noMidiDemo) toggleDemoChord(&g_demoSynth);
+        	else toggleActiveWavetable(&g_demoSynth);
 
         	funcToggled = 1;
         }
@@ -35,13 +35,38 @@
 #ifndef SPEAKEZ_H_
 #define SPEAKEZ_H_
 
+#include <cr_section_macros.h>
 #include "arm_math.h"
+#include "fsl_edma.h"
+#include "fsl_dmamux.h"
 #include "usbmidi.h"
 
+/*
+ * Set to 1 to time the DSP stages with the DWT cycle counter at boot,
+ * before the CODEC starts, and print the cycles per frame of each.
+ */
+#define SPEAKEZ_BENCHMARK		0
+
 #define TWELFTH_ROOT_OF_TWO 	1.05946309436f
 #define THIRD_ROOT_OF_TWO		1.25992104989f
 #define TONE_A3_HZ				220.0f
 
+/*
+ * Set to 1 to run the oscillator phases as 32-bit fixed-point
+ * accumulators instead of floats. The top log2(kSynth_Table_Length)
+ * bits index the wavetable and the rest form the interpolation fraction,
+ * so wrapping is free and long-held notes don't drift.
+ */
+#define SYNTH_FIXED_POINT_PHASE	1
+#define SYNTH_PHASE_FRAC_BITS	23U // 32 - log2(kSynth_Table_Length)
+#define SYNTH_PHASE_FRAC_MASK	((1U << SYNTH_PHASE_FRAC_BITS) - 1U)
+
+#if SYNTH_FIXED_POINT_PHASE
+typedef uint32_t synth_phase_t;
+#else
+typedef float synth_phase_t;
+#endif
+
 enum _speakEZ_synth_constants {
 	kSynth_Table_Length 	= 512U,
 	kSynth_Max_Audio_Level 	= 3000000, // To protect the ears. 8388607 is true max
@@ -52,25 +77,154 @@ enum _speakEZ_synth_constants {
 	kSynth_Pbend_Semitones	= 2U	// number of semitones that can be bent up, or down
 };
 
+/*
+ * Each waveform is kept as one band-limited copy per octave. Level L
+ * holds only the harmonics below (kSynth_Table_Length / 2) >> L, so a
+ * voice whose phase increment stays at or under 2^L never reads a
+ * partial above Nyquist.
+ *
+ * Levels are stored as int16 and scaled back up by SYNTH_MIP_SCALE;
+ * the headroom leaves room for the Gibbs overshoot of the saw and novel edges.
+ */
+enum _speakEZ_mipmap_constants {
+	kSynth_Mip_Levels		= 8U,	// 2^7 covers the top MIDI keys
+	kSynth_Mip_Full_Scale	= 32767
+};
+
+#define SYNTH_MIP_HEADROOM		1.25f
+#define SYNTH_MIP_SCALE			(SYNTH_MIP_HEADROOM * kSynth_Max_Audio_Level / kSynth_Mip_Full_Scale)
+
 enum _speakEZ_audio_constants {
 	kAudio_Frame_Hz = 46880U, // Measured with logic analyzer on LRCK, despite 48000 Hz MCUXpresso setting
-	kAudio_Buffer_Words = 2U
+	kAudio_Buffer_Words = 2U, // Words per frame (left, right)
+	kAudio_Block_Frames = 32U, // Frames per DMA half-buffer; 16, 32 or 64 all work
+	kAudio_Block_Words = kAudio_Block_Frames * kAudio_Buffer_Words,
+	kAudio_Fifo_Blocks = 4U // Blocks per audio FIFO, power of two; half are primed as output latency
 };
 
+#define SAI1_RX_DMA_CHANNEL		0U
+#define SAI1_TX_DMA_CHANNEL		1U
+#define SAI1_RX_DMA_IRQN		DMA0_IRQn // must match SAI1_RX_DMA_CHANNEL
+
 
 status_t writeToWM8960(uint8_t controlReg, uint16_t controlWord);
 void configureWM8960();
 
 
-int32_t inputAudioBuffer[kAudio_Buffer_Words] = 			{0}; // Rx buffer used in program calculations
-volatile int32_t SAI1_rxAudio[kAudio_Buffer_Words] = 		{0}; // Protected Rx buffer used by SAI1_IRQHandler
-int32_t outputAudioBuffer[kAudio_Buffer_Words] = 			{0}; // Tx buffer used in program calculations
-volatile int32_t SAI1_txAudio[kAudio_Buffer_Words] = 		{0}; // Protected Tx buffer used by SAI1_IRQHandler
+/*
+ * The eDMA runs circularly over these ping-pong buffers, two blocks each.
+ * They must live in the non-cacheable region so the core never reads
+ * stale lines or leaves dirty ones behind the DMA's back.
+ *
+ * The managed linker script places NCACHE_REGION by MCUXpresso bank name,
+ * not by the SDK's "NonCacheable" section, so we use __BSS here.
+ */
+__BSS(NCACHE_REGION) int32_t SAI1_rxDmaBuffer[2 * kAudio_Block_Words] __attribute__((aligned(32)));
+__BSS(NCACHE_REGION) int32_t SAI1_txDmaBuffer[2 * kAudio_Block_Words] __attribute__((aligned(32)));
+
+edma_handle_t g_SAI1_rxDmaHandle;
+
+
+/*
+ * audioFifo Structure
+ *
+ * Lock-free single-producer/single-consumer queue of audio blocks
+ * between the Rx DMA interrupt and the program loop.
+ *
+ * head and tail are free-running counters; each is written by only
+ * one side, and published after (or before) touching block data.
+ */
+typedef struct audioFifo {
+
+	int32_t block[kAudio_Fifo_Blocks][kAudio_Block_Words];
+	volatile uint32_t head;			// written only by the producer
+	volatile uint32_t tail;			// written only by the consumer
+
+	volatile uint32_t overruns;		// producer found the FIFO full
+	volatile uint32_t underruns;	// consumer found the FIFO empty when it could not wait
 
+	uint32_t endFrame[kAudio_Fifo_Blocks];	// g_audioFrameCount as each block was published
 
-void setTxAudio(int32_t *audioBuffer);
-void getRxAudio(int32_t *audioBuffer);
+} audioFifo;
 
+audioFifo g_rxAudioFifo;	// voice blocks, DMA interrupt -> program loop
+audioFifo g_txAudioFifo;	// output blocks, program loop -> DMA interrupt
+
+int32_t *audioFifoWriteSlot(audioFifo *fifo);
+void audioFifoPublish(audioFifo *fifo);
+int32_t *audioFifoReadSlot(audioFifo *fifo);
+void audioFifoRelease(audioFifo *fifo);
+
+/*
+ * SAI frames captured since the DMA started, advanced a block at a time
+ * by SAI1_RxDmaCallback. getAudioFrameTime adds the DMA's position in
+ * the block under way, for a clock that ticks every frame.
+ */
+volatile uint32_t g_audioFrameCount = 0;
+
+uint32_t getAudioFrameTime(void);
+
+/*
+ * Frame time of the last USB transfer-complete interrupt, latched by
+ * USB_OTG1_IRQHandler. getMidiArrivalTime hands it to the MIDI ring, so
+ * packets carry the frame they arrived at, not the one the polled USB
+ * task got round to them at.
+ */
+volatile uint32_t g_usbTransferDoneTime = 0;
+
+uint32_t getMidiArrivalTime(void);
+
+
+void initAudioDma(void);
+void SAI1_RxDmaCallback(edma_handle_t *handle, void *userData, bool transferDone, uint32_t tcds);
+
+
+/*
+ * Size of the voice pool. At most this many keys sound at once, which
+ * bounds the synth's share of each audio block. 8, 16 or 32 all fit;
+ * must not exceed kSynth_Num_Keys.
+ */
+#define SYNTH_MAX_VOICES		16U
+
+/*
+ * A stolen voice leaves the pool at once but fades out over
+ * kSynth_Steal_Fade_Frames beside it, since cutting it off mid-cycle
+ * clicks. Up to SYNTH_MAX_FADING fade at a time; past that, the oldest
+ * fade is cut short.
+ */
+#define SYNTH_MAX_FADING		4U
+
+enum _speakEZ_voice_steal_constants {
+	kSynth_Steal_Fade_Frames = 64U	// about 1.4 ms
+};
+
+typedef enum _speakEZ_voice_steal_policies {
+	kSynth_Steal_Oldest = 0,	// a new note takes the longest-held voice
+	kSynth_Steal_Quietest,		// a new note takes the voice with the lowest gain
+	kSynth_Steal_Same_Note		// only a repeated note retriggers, in phase; new notes wait for a free voice
+} voice_steal_t;
+
+typedef enum _speakEZ_velocity_curves {
+	kSynth_Velocity_Linear = 0,
+	kSynth_Velocity_Exponential,
+	kSynth_Velocity_Table
+} velocity_curve_t;
+
+#define SYNTH_VELOCITY_EXP_RANGE_DB		40.0f
+
+float velocityCurveTable[kSynth_Max_Velocity + 1] = {0};
+
+/*
+ * wavetableMipmap Structure
+ *
+ * Per-octave band-limited copies of one waveform. Waveforms with fewer
+ * stored levels (the sine) point their upper levels at the last one.
+ */
+typedef struct wavetableMipmap {
+
+	const int16_t *level[kSynth_Mip_Levels];
+
+} wavetableMipmap;
 
 /*
  * wavetableSynth Structure
@@ -83,11 +237,28 @@ void getRxAudio(int32_t *audioBuffer);
 typedef struct wavetableSynth {
 
 	float freq[kSynth_Num_Keys];
-	float phase[kSynth_Num_Keys];
+	synth_phase_t phase[kSynth_Num_Keys];
 	float phaseIncrement[kSynth_Num_Keys];
 	float pbendFactor;
+	synth_phase_t phaseStep[kSynth_Num_Keys];		// bent increment, recomputed only when the bend moves
+	synth_phase_t phaseStepNow[kSynth_Num_Keys];	// increment reached at the end of the last block
 	uint32_t velocity[kSynth_Num_Keys];
-	int32_t *wavetable;
+	float gain[kSynth_Num_Keys];			// velocity mapped through velocityCurve at note-on
+	velocity_curve_t velocityCurve;
+	const wavetableMipmap *wavetable;
+	uint8_t mipLevel[kSynth_Num_Keys];		// band-limited table level each key reads
+
+	uint8_t activeKeys[SYNTH_MAX_VOICES];	// voice pool: dense list of sounding key indices
+	uint8_t activeSlot[kSynth_Num_Keys];	// pool slot of each sounding key
+	uint32_t numActive;
+	uint32_t noteOnStamp[kSynth_Num_Keys];	// value of noteOnCount when each key last started
+	uint32_t noteOnCount;
+	voice_steal_t voiceSteal;
+
+	uint8_t fadingKeys[SYNTH_MAX_FADING];	// stolen keys still fading out, oldest first
+	uint32_t fadeFrames[SYNTH_MAX_FADING];	// frames each has left to fade
+	float fadeStep[SYNTH_MAX_FADING];		// gain each loses per frame
+	uint32_t numFading;
 
 	usbmidi_channel_number_t midiChannel;
 
@@ -102,10 +273,31 @@ typedef struct wavetableSynth {
  * There are so many unique periodic sounds you can
  * make with interesting mathematical statements.
  */
-int32_t wavetableSine[kSynth_Table_Length] 		= {0};
-int32_t wavetableTri[kSynth_Table_Length] 		= {0};
-int32_t wavetableSaw[kSynth_Table_Length] 		= {0};
-int32_t wavetableNovel[kSynth_Table_Length] 	= {0};
+wavetableMipmap wavetableSine;
+wavetableMipmap wavetableTri;
+wavetableMipmap wavetableSaw;
+wavetableMipmap wavetableNovel;
+
+/*
+ * The mip levels are built once at boot, so they live in the otherwise
+ * unused OCRAM rather than the DTC, which holds the hot DSP state.
+ * The sine has no partials to remove and needs only one level.
+ */
+__BSS(SRAM_OC) int16_t wavetableSineLevels[1][kSynth_Table_Length];
+__BSS(SRAM_OC) int16_t wavetableTriLevels[kSynth_Mip_Levels][kSynth_Table_Length];
+__BSS(SRAM_OC) int16_t wavetableSawLevels[kSynth_Mip_Levels][kSynth_Table_Length];
+__BSS(SRAM_OC) int16_t wavetableNovelLevels[kSynth_Mip_Levels][kSynth_Table_Length];
+
+/*
+ * Boot-time scratch for building the mip levels: the naive waveform and
+ * the FFT buffers. Nothing touches them after startup, so they sit in
+ * the non-cacheable bank next to the DMA buffers and keep the DTC free.
+ */
+__BSS(NCACHE_REGION) int32_t wavetableNaive[kSynth_Table_Length];
+__BSS(NCACHE_REGION) float wavetableFftIn[kSynth_Table_Length];
+__BSS(NCACHE_REGION) float wavetableFftSpectrum[kSynth_Table_Length];
+__BSS(NCACHE_REGION) float wavetableFftOut[kSynth_Table_Length];
+
 enum _speakEZ_wavetable_library {
 	kSynth_Wavetable_Sine						= 0,
 	kSynth_Wavetable_Tri,
@@ -135,37 +327,110 @@ void setWavetableSine(int32_t *inputWavetable, uint32_t tableLen);
 void setWavetableTri(int32_t *inputWavetable, uint32_t tableLen);
 void setWavetableSaw(int32_t *inputWavetable, uint32_t tableLen);
 void setWavetableNovel(int32_t *inputWavetable, uint32_t tableLen);
+void buildWavetableMipmap(wavetableMipmap *mipmap, int16_t (*levels)[kSynth_Table_Length], uint32_t numLevels, const int32_t *naiveTable);
+uint8_t mipLevelForIncrement(float phaseIncrement);
 
 void toggleActiveWavetable(wavetableSynth *synth);
 void playDemoChord(wavetableSynth *synth, uint32_t chordNum);
 void toggleDemoChord(wavetableSynth *synth);
 
+wavetableSynth g_demoSynth;
+
 void initSynth(wavetableSynth *synth, uint32_t numKeys, uint32_t indexA3, float freqA3, usbmidi_channel_number_t chNum);
+void playSynthBlock(wavetableSynth *synth, int32_t *audioOut, uint32_t frames);
+void renderVoice(wavetableSynth *synth, uint32_t keyIndex, float *mix, uint32_t frames, float gain, float gainStep);
 int32_t playSynth(wavetableSynth *synth);
 void pressKey(wavetableSynth *synth, uint32_t keyIndex, uint32_t keyVelocity);
 void releaseKey(wavetableSynth *synth, uint32_t keyIndex);
+uint32_t findStealVictim(wavetableSynth *synth);
+void stealVoice(wavetableSynth *synth, uint32_t keyIndex);
+void cancelFade(wavetableSynth *synth, uint32_t keyIndex);
+float velocityToGain(velocity_curve_t curve, uint32_t keyVelocity);
+void setVelocityTableSoft(float *table);
 void updatePitchbend(wavetableSynth *synth, uint32_t pbLSB, uint32_t pbMSB);
+synth_phase_t bentPhaseStep(wavetableSynth *synth, uint32_t keyIndex);
 
 
-_Bool getSAI_RequestSynthUpdate();
-void clearSAI_RequestSynthUpdate();
-
 _Bool getSW4Pressed(void);
 
 void handleMidiEventPacket(wavetableSynth *synth, usbmidi_event_packet_t event);
 
 
+/*
+ * Received MIDI events carry the audio frame time they arrived at, and
+ * are played at the same offset into the block captured at that time,
+ * so notes start on their frame rather than on a block boundary. The
+ * latency from key to sound is then the fixed audio pipeline delay.
+ */
+enum _speakEZ_midi_schedule {
+	kMidi_Schedule_Events = 16U	// per block; any more slip to the next block
+};
+
+/*
+ * midiSchedule Structure
+ *
+ * The events due in the audio block about to be rendered, sorted by
+ * frame offset. One more event, already taken off the receive queue
+ * but due in a later block, can be held back until its block comes up.
+ */
+typedef struct midiSchedule {
+
+	usbmidi_event_packet_t event[kMidi_Schedule_Events];
+	uint8_t offset[kMidi_Schedule_Events];	// frame within the block
+	uint32_t count;
+
+	usbmidi_event_packet_t heldEvent;
+	uint32_t heldTime;
+	_Bool held;
+
+	uint32_t late;			// events whose frame was already rendered, played at frame 0
+	uint32_t slipped;		// events pushed to the next block for lack of room
+
+} midiSchedule;
+
+midiSchedule g_midiSchedule;
+
+_Bool scheduleMidiEvent(midiSchedule *schedule, usbmidi_event_packet_t event, uint32_t offset);
+void scheduleMidiBlock(midiSchedule *schedule, usb_host_midi_packet_ring_t *queue, uint32_t blockStart, uint32_t frames);
+void playScheduledSynthBlock(wavetableSynth *synth, midiSchedule *schedule, int32_t *audioOut, uint32_t frames);
+
+
 /*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*
  *~*~* V O C O D E R   S T U F F *~*~*
  *~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*/
 
 enum _speakEZ_resampling_constants {
 	kResample_Downsample_Rate = 6, // CODEC LRCK cycles per downsample
-	kResample_Phoneme_LP = 3400, // Hz
+	kResample_Phoneme_LP = 3800, // Hz, half-gain point of the voice decimator
 	kResample_Sibilance_HP = 3500, // Hz
 	kResample_Envelope_Freq = 100 // Hz
 };
 
+enum _speakEZ_vocoder_block_constants {
+	kVocoder_Max_Block_Ticks = kAudio_Block_Frames / kResample_Downsample_Rate + 1, // downsampled voice samples per block, at most
+	kVoxDecimator_Taps = 121U,
+	kVoxDecimator_Delay = (kVoxDecimator_Taps - 1) / 2, // full-rate frames
+	kVoxDecimator_Max_Input = kVocoder_Max_Block_Ticks * kResample_Downsample_Rate
+};
+
+#define VOCODER_MIX_GAIN					0.00005f
+
+/*
+ * Polyphase decimator taking the voice down to the analysis rate.
+ * Frames left over from a block (fewer than kResample_Downsample_Rate)
+ * wait in voxDecimatorCarry for the next one.
+ */
+float voxDecimatorCoeffs[kVoxDecimator_Taps]	= {0};
+arm_fir_decimate_instance_f32 voxDecimator;
+float voxDecimatorState[kVoxDecimator_Taps + kVoxDecimator_Max_Input - 1];
+float voxDecimatorCarry[kResample_Downsample_Rate];
+uint32_t voxDecimatorCarryCount				= 0;
+void initVoxDecimator(void);
+uint32_t decimateVoiceBlock(const float *voice, size_t frames, float *downsampledVoice, uint32_t *segmentStart);
+void setTickSegments(uint32_t *segmentStart, uint32_t ticks, uint32_t carried, size_t frames);
+
+void processAudioBlock(const int32_t *in, int32_t *out, size_t frames);
+
 typedef enum _speakEZ_filter_types {
 	kFilter_Low_Pass = 0,
 	kFilter_High_Pass,
@@ -175,15 +440,11 @@ typedef enum _speakEZ_filter_types {
 
 void calculateBiquadCoeffs(float *coeffs, float fC, float fS, uint8_t filterType, float Q_OR_BW);
 
-float lowpassBiquadQ				= 0.9;
-float lowpassBiquadInputs[2]		= {0};
-float lowpassBiquadOutputs[2]		= {0};
-float runLowpassBiquad(float newInput, float *coeffs);
-
-
 float sibilanceBiquadQ				= 0.9;
 float sibilanceBiquadInputs[2]		= {0};
 float sibilanceBiquadOutputs[2]		= {0};
+float sibilanceBiquadCoeffs[5]		= {0};
+void runSibilanceBiquadBlock(const float *newInputs, float *newOutputs, uint32_t frames, float *coeffs);
 float runSibilanceBiquad(float newInput, float *coeffs);
 
 /*
@@ -191,6 +452,9 @@ float runSibilanceBiquad(float newInput, float *coeffs);
  * bands per octave, from 3100 Hz down to around 150 Hz.
  *
  * Feel free to play around with these frequencies!
+ *
+ * These are the bands the vocoder starts with;
+ * see vocoderConfig for changing them on the fly.
  */
 #define NUM_VOCODER_BANDS			18
 const float bandpassBiquadF0[NUM_VOCODER_BANDS] = {
@@ -215,21 +479,523 @@ const float bandpassBiquadF0[NUM_VOCODER_BANDS] = {
 };
 
 float analysisBiquadBWs[NUM_VOCODER_BANDS] 			= {0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1,0.1};
-float analysisBiquadInputs[2] 						= {0};
-float analysisBiquadOutputs[NUM_VOCODER_BANDS][3] 	= {0};
-float analysisBiquadAbs[NUM_VOCODER_BANDS]	 		= {0};
-void runAnalysisBiquad(float newInput, float *coeffs);
+float shapingBiquadBWs[NUM_VOCODER_BANDS] 			= {0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2};
+
+enum _speakEZ_vocoder_band_constants {
+	kVocoder_Max_Bands = 32U // most bands a vocoderConfig can hold
+};
 
 
 float envelopeFollowerQ								= 0.9;
-float envelopeFollowerInputs[NUM_VOCODER_BANDS][2] 	= {0};
-float envelopeFollowerOutputs[NUM_VOCODER_BANDS][3] = {0};
-void runEnvelopeFollower(float *inputArray, float *coeffs);
+float envelopeFollowerCoeffs[5]						= {0};
+
+typedef enum _speakEZ_follower_types {
+	kFollower_Biquad = 0,		// 2nd-order lowpass at kResample_Envelope_Freq
+	kFollower_Attack_Release,	// one-pole, separate attack and release times
+	kFollower_Peak_Hold			// attack/release, holding each peak before releasing
+} follower_type_t;
+
+enum _speakEZ_follower_cc {
+	kCC_Follower_Release	= 72,	// MIDI sound controller 3, release time
+	kCC_Follower_Attack		= 73,	// MIDI sound controller 4, attack time
+	kCC_Follower_Type		= 80,	// general purpose 5, split into thirds by follower_type_t
+	kCC_Follower_Hold		= 81	// general purpose 6, peak hold time
+};
 
+#define FOLLOWER_ATTACK_MIN_MS		0.5f
+#define FOLLOWER_ATTACK_MAX_MS		50.0f
+#define FOLLOWER_RELEASE_MIN_MS		5.0f
+#define FOLLOWER_RELEASE_MAX_MS		500.0f
+#define FOLLOWER_HOLD_MAX_MS		200.0f
 
-float shapingBiquadBWs[NUM_VOCODER_BANDS] 			= {0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2,0.2};
-float shapingBiquadInputs[2] 						= {0};
-float shapingBiquadOutputs[NUM_VOCODER_BANDS][3] 	= {0};
-void runShapingBiquad(float newInput, float *coeffs);
+/*
+ * envelopeFollower Structure
+ *
+ * Selects how the rectified analysis bands are smoothed into envelopes.
+ * The times are set with setEnvelopeFollower, which works out the
+ * one-pole coefficients and hold length at the analysis rate.
+ */
+typedef struct envelopeFollower {
+
+	follower_type_t type;
+	float attackMs;
+	float releaseMs;
+	float holdMs;
+
+	float attackCoeff;
+	float releaseCoeff;
+	uint32_t holdTicks;
+
+} envelopeFollower;
+
+envelopeFollower g_envelopeFollower;
+
+void setEnvelopeFollower(envelopeFollower *follower, follower_type_t type, float attackMs, float releaseMs, float holdMs);
+void handleControlChange(uint8_t controller, uint8_t value);
+
+
+/*
+ * bandpassBiquadBank Structure
+ *
+ * A bank of parallel bandpass biquads, all fed the same input,
+ * laid out structure-of-arrays so one loop walks every band per sample.
+ *
+ * Each band runs in transposed direct form II, so there is no
+ * history to shift. A bandpass has b1 = 0 and b2 = -b0, which
+ * leaves three coefficients per band.
+ */
+typedef struct bandpassBiquadBank {
+
+	float b0[kVocoder_Max_Bands];
+	float a1[kVocoder_Max_Bands];
+	float a2[kVocoder_Max_Bands];
+	float s1[kVocoder_Max_Bands];	// transposed direct form II state
+	float s2[kVocoder_Max_Bands];
+
+} bandpassBiquadBank;
+
+void setBandpassBankCoeffs(bandpassBiquadBank *bank, uint32_t band, const float *coeffs);
+
+
+/*
+ * The shaping bank runs as an octave tree. The carrier is halved in
+ * rate up to three times with half-band filters, and each band runs at
+ * the lowest rate that is still kVocoder_Rate_Per_F0 times its center.
+ * The modulated bands of each rate are interpolated back up and summed.
+ *
+ * Every rate's carrier is delayed to line up with the round trip
+ * through the rates below it, so all bands come out together,
+ * kVocoder_Align_Delay frames late.
+ */
+enum _speakEZ_multirate_constants {
+	kVocoder_Rate_Levels		= 4U,	// full rate, then halved up to three times
+	kVocoder_Rate_Per_F0		= 16U,
+	kHalfband_Taps				= 15U,	// every other tap but the center is zero
+	kHalfband_Delay				= (kHalfband_Taps - 1) / 2,	// at the filter's higher rate
+	kHalfband_Interp_Taps		= kHalfband_Taps + 1,	// the interpolator wants a multiple of 2
+	kHalfband_Round_Trip		= 2 * kHalfband_Delay - 1,	// down and back up; the decimator keeps the later sample of each pair
+	kVocoder_Align_Delay		= kHalfband_Round_Trip * ((1U << (kVocoder_Rate_Levels - 1)) - 1)
+};
+
+float halfbandDecimCoeffs[kHalfband_Taps]			= {0};
+float halfbandInterpCoeffs[kHalfband_Interp_Taps]	= {0};
+arm_fir_decimate_instance_f32 carrierDecimators[kVocoder_Rate_Levels - 1];
+float carrierDecimatorStates[kVocoder_Rate_Levels - 1][kHalfband_Taps + kAudio_Block_Frames - 1];
+
+__BSS(SRAM_ITC) float carrierAlignLines[kVocoder_Rate_Levels - 1][kVocoder_Align_Delay + kAudio_Block_Frames];
+__BSS(SRAM_ITC) float carrierLevels[kVocoder_Rate_Levels][kAudio_Block_Frames];	// aligned carrier at each rate
+__BSS(SRAM_ITC) float vocodedLevels[kVocoder_Rate_Levels][kAudio_Block_Frames];	// modulated bands summed at each rate
+
+void initCarrierOctaves(void);
+void splitCarrierOctaves(const float *carrier, uint32_t frames);
+uint32_t carrierAlignDelay(uint32_t level);
+
+
+/*
+ * vocoderConfig Structure
+ *
+ * Everything that depends on the band layout of the biquad engine:
+ * the bands themselves, their coefficients, and the filter state that
+ * goes with them.
+ *
+ * There are two. The program fills the idle one, and processAudioBlock
+ * runs it beside the active one until its filters have rung up, then
+ * crossfades over to it, so the change never clicks, dips, or holds up
+ * the audio.
+ */
+typedef struct vocoderConfig {
+
+	uint32_t numBands;
+	float minHz;							// lowest and highest band centers
+	float maxHz;
+	float f0[kVocoder_Max_Bands];			// band centers, highest first
+	float analysisBW[kVocoder_Max_Bands];	// bandwidths in octaves, per band
+	float shapingBW[kVocoder_Max_Bands];
+	float outputGain[kVocoder_Max_Bands];	// per-band output level, the vocoder EQ
+
+	float analysisCoeffs[kVocoder_Max_Bands * 5];
+	float analysisInputs[2];
+	float analysisOutputs[kVocoder_Max_Bands][2];
+	float envelopeInputs[kVocoder_Max_Bands][2];
+	float envelopeOutputs[kVocoder_Max_Bands][2];
+	uint32_t envelopeHold[kVocoder_Max_Bands];	// peak hold ticks left, per band
+	float envelopeRampFrom[kVocoder_Max_Bands];	// envelope the last gain ramp set out from
+	bandpassBiquadBank shaping;		// each band's coefficients are for its own rate
+
+	uint32_t levelFirstBand[kVocoder_Rate_Levels + 1];	// bands at rate level L are levelFirstBand[L] up to levelFirstBand[L + 1]
+	arm_fir_interpolate_instance_f32 upsamplers[kVocoder_Rate_Levels - 1];
+	float upsamplerStates[kVocoder_Rate_Levels - 1][kHalfband_Interp_Taps / 2 + kAudio_Block_Frames / 2 - 1];
+
+	uint32_t warmupBlocks;	// blocks to run unheard before crossfading in, from the slowest band's ring-up
+
+} vocoderConfig;
+
+/*
+ * A newly committed config runs unheard for kVocoder_Warmup_Time_Constants
+ * of its slowest filter's ring-up time, then the output crossfades to it
+ * over kVocoder_Crossfade_Blocks.
+ */
+enum _speakEZ_config_changeover {
+	kVocoder_Warmup_Time_Constants	= 4U,	// within 2% of where it would have been
+	kVocoder_Crossfade_Blocks		= 4U
+};
+
+/*
+ * The configs, and the per-block scratch sized for kVocoder_Max_Bands,
+ * are too big for the DTC and the stack, so they share the ITC bank.
+ */
+__BSS(SRAM_ITC) vocoderConfig g_vocoderConfigs[2];
+uint32_t g_activeVocoderConfig						= 0;
+volatile _Bool g_vocoderConfigPending				= 0;
+uint32_t g_vocoderConfigBlocks						= 0;	// blocks the pending config has run
+
+__BSS(SRAM_ITC) float shapingBiquadBlock[kAudio_Block_Frames][kVocoder_Max_Bands];
+__BSS(SRAM_ITC) float vocoderAnalysisAbs[kVocoder_Max_Block_Ticks * kVocoder_Max_Bands];
+__BSS(SRAM_ITC) float vocoderEnvelopes[(kVocoder_Max_Block_Ticks + 1) * kVocoder_Max_Bands];
+__BSS(SRAM_ITC) float vocoderGainSlopes[(kVocoder_Max_Block_Ticks + 1) * kVocoder_Max_Bands];
+
+void setVocoderBands(vocoderConfig *cfg, uint32_t numBands, const float *f0, const float *analysisBWs, const float *shapingBWs);
+void setVocoderBandsLogSpaced(vocoderConfig *cfg, uint32_t numBands, float minHz, float maxHz, float analysisBW, float shapingBW);
+void setVocoderBandGain(vocoderConfig *cfg, uint32_t band, float gain);
+vocoderConfig *getIdleVocoderConfig(void);
+void commitVocoderConfig(vocoderConfig *cfg);
+void buildVocoderConfig(vocoderConfig *cfg);
+void seedVocoderEnvelopes(vocoderConfig *cfg, const vocoderConfig *from);
+
+void runAnalysisBiquadBlock(vocoderConfig *cfg, const float *newInputs, float *absOutputs, uint32_t ticks);
+void runAnalysisBiquad(vocoderConfig *cfg, float newInput);
+void runEnvelopeFollowerBlock(vocoderConfig *cfg, const float *inputArray, float *outputArray, uint32_t ticks, float *coeffs);
+void runEnvelopeFollower(vocoderConfig *cfg, float *inputArray, float *coeffs);
+void runAttackReleaseFollowerBlock(vocoderConfig *cfg, const float *inputArray, float *outputArray, uint32_t ticks,
+		const envelopeFollower *follower);
+void runShapingBiquadBlock(const float *newInputs, uint32_t frames, bandpassBiquadBank *bank, uint32_t firstBand, uint32_t endBand);
+void runVocoderBands(vocoderConfig *cfg, const float *downsampledVoice, uint32_t ticks, _Bool voiceActive,
+		const uint32_t *segmentStart, float *vocoded, uint32_t frames);
+
+/*
+ * Voice activity detection, on the downsampled voice. Each VAD frame
+ * of kVad_Frame_Ticks is judged by its energy against a tracked noise
+ * floor, and by its zero-crossing rate, which lets quieter unvoiced
+ * sounds through. Speech holds the detector open for a hangover.
+ *
+ * While silent, the biquad engine skips analysis and envelope
+ * following, and once the envelopes have died away, the whole
+ * band stage.
+ */
+typedef enum _speakEZ_vad_modes {
+	kVad_Off = 0,		// every stage runs all the time
+	kVad_Freeze,		// hold the envelopes while silent
+	kVad_Decay,			// let the envelopes die away while silent
+	kVad_Passthrough	// as kVad_Decay, but play the synth dry while silent
+} vad_mode_t;
+
+enum _speakEZ_vad_constants {
+	kVad_Frame_Ticks		= 64U,	// about 8 ms
+	kVad_Hangover_Frames	= 25U,	// about 200 ms
+	kCC_Vad_Mode			= 82	// general purpose 7, split into quarters by vad_mode_t
+};
+
+#define VAD_MIN_ENERGY				7.0e7f	// mean square, about -60 dBFS
+#define VAD_ENERGY_RATIO			8.0f	// speech over the noise floor, about 9 dB
+#define VAD_ZCR_THRESHOLD			0.25f	// crossings per tick that mark unvoiced sound
+#define VAD_FLOOR_ADAPT				0.05f	// per silent frame
+#define VAD_DECAY_MS				50.0f	// envelope time constant while silent
+#define VAD_PASSTHROUGH_GAIN		0.5f
+#define VAD_PASSTHROUGH_STEP		0.0625f	// per block
+
+/*
+ * voiceActivityDetector Structure
+ *
+ * Running state of the VAD, and what the vocoder does with it.
+ */
+typedef struct voiceActivityDetector {
+
+	vad_mode_t mode;
+
+	float energy;				// summed over the current VAD frame
+	uint32_t crossings;
+	uint32_t frameTicks;
+	float lastSample;
+	float noiseFloor;			// mean square of silent frames
+	uint32_t hangover;			// frames left before going silent
+
+	_Bool active;
+	uint32_t silentTicks;		// since the detector went silent
+	float envelopeDecay;		// per tick, while silent
+	uint32_t gateTicks;			// silent ticks until the envelopes are gone
+	float passthroughLevel;		// 0 to 1, ramped a block at a time
+
+} voiceActivityDetector;
+
+voiceActivityDetector g_vad;
+
+void initVoiceActivity(voiceActivityDetector *vad, vad_mode_t mode);
+_Bool updateVoiceActivity(voiceActivityDetector *vad, const float *downsampledVoice, uint32_t ticks);
+_Bool isVocoderGated(const voiceActivityDetector *vad);
+
+/*
+ * Voiced/unvoiced classification, for the sibilance path. Once a
+ * block, the analysis bands above UV_SPLIT_HZ are weighed against the
+ * ones below, alongside the voice's zero-crossing rate: hiss-like
+ * consonants are bright and cross often, vowels are neither.
+ */
+typedef enum _speakEZ_sibilance_modes {
+	kSibilance_Always = 0,	// the high-passed voice always goes out
+	kSibilance_Gated,		// only on unvoiced sounds
+	kSibilance_Noise		// shaped noise in its place, on unvoiced sounds
+} sibilance_mode_t;
+
+enum _speakEZ_voicing_cc {
+	kCC_Sibilance_Mode		= 83	// general purpose 8, split into thirds by sibilance_mode_t
+};
+
+#define UV_SPLIT_HZ					2000.0f
+#define UV_LEVEL_RATIO				2.0f	// high band mean over low band mean that counts as unvoiced
+#define UV_ZCR_THRESHOLD			0.3f	// crossings per tick
+#define UV_SMOOTHING				0.2f	// per block
+#define UV_GATE_STEP				0.25f	// per block
+#define UV_NOISE_GAIN				2.0f	// noise amplitude per unit of high band level
+
+/*
+ * voicingClassifier Structure
+ *
+ * Running state of the classifier and the sibilance gate,
+ * and of the noise source that can stand in for the voice.
+ */
+typedef struct voicingClassifier {
+
+	sibilance_mode_t mode;
+
+	float highLevel;		// smoothed mean of the rectified bands above UV_SPLIT_HZ
+	float lowLevel;			// and below
+	float zcr;				// smoothed crossings per tick
+	float lastSample;
+	_Bool unvoiced;
+	float gate;				// 0 to 1, ramped a block at a time
+
+	uint32_t noiseSeed;
+	float noiseInputs[2];
+	float noiseOutputs[2];
+
+} voicingClassifier;
+
+voicingClassifier g_voicing;
+
+void initVoicing(voicingClassifier *uv, sibilance_mode_t mode);
+void updateVoicing(voicingClassifier *uv, const vocoderConfig *cfg, const float *absBands,
+		const float *downsampledVoice, uint32_t ticks);
+void applySibilanceGate(voicingClassifier *uv, float *sibilance, uint32_t frames);
+
+/*
+ * audioLoadMeter Structure
+ *
+ * Cycles spent in processAudioBlock, measured with the DWT cycle
+ * counter. spareCycles is what the last block left of its period,
+ * for other work in the program loop to use.
+ *
+ * Sending kCC_Load_Report asks for the meter to be printed; the
+ * program loop does so once the blocks waiting have been processed.
+ */
+typedef struct audioLoadMeter {
+
+	uint32_t blockCycles;
+	uint32_t peakCycles;	// since the last report
+	uint32_t spareCycles;
+	float load;				// smoothed fraction of the block period
+	_Bool reportPending;
+
+} audioLoadMeter;
+
+#define AUDIO_LOAD_SMOOTHING		0.05f
+
+enum _speakEZ_load_cc {
+	kCC_Load_Report			= 85	// undefined in MIDI, any value prints the load
+};
+
+audioLoadMeter g_audioLoad;
+
+void enableCycleCounter(void);
+void updateAudioLoadMeter(audioLoadMeter *meter, uint32_t cycles, size_t frames);
+void reportAudioLoad(audioLoadMeter *meter);
+
+/*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*
+ *~*~*~*  S T F T   E N G I N E  *~*~*
+ *~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*/
+
+/*
+ * The vocoder can run on the biquad banks above, or on an overlap-add
+ * STFT of the voice and the carrier. The STFT's cost hardly depends on
+ * the band count, so it can run many more bands, but it holds the
+ * audio back by a whole frame (see getVocoderLatencyFrames).
+ */
+typedef enum _speakEZ_vocoder_engines {
+	kVocoder_Engine_Biquad = 0,
+	kVocoder_Engine_Stft,
+	kVocoder_Engine_Fixed		// the biquad engine in Q31, see below
+} vocoder_engine_t;
+
+vocoder_engine_t g_vocoderEngine = kVocoder_Engine_Biquad;
+
+enum _speakEZ_stft_constants {
+	kStft_Frame_Length 	= 512U, // about 91.6 Hz per bin
+	kStft_Hop 			= kStft_Frame_Length / 2, // 50% overlap; must be a multiple of kAudio_Block_Frames
+	kStft_Bins 			= kStft_Frame_Length / 2,
+	kStft_Max_Bands 	= 64U
+};
+
+#define STFT_ENVELOPE_SMOOTHING		0.5f // one-pole smoothing per hop, about 10 ms
+
+/*
+ * stftVocoder Structure
+ *
+ * Band layout and running state of the STFT engine.
+ * Band b covers bins bandEdge[b] up to, but not including, bandEdge[b + 1].
+ * Bins from sibilanceBin up pass the voice straight through,
+ * standing in for the sibilance filter of the biquad engine.
+ */
+typedef struct stftVocoder {
+
+	arm_rfft_fast_instance_f32 fft;
+	uint32_t numBands;
+	uint16_t bandEdge[kStft_Max_Bands + 1];
+	uint16_t sibilanceBin;
+	float envelope[kStft_Max_Bands];
+	float envelopeScale;	// turns band magnitude into time-domain amplitude
+	uint32_t hopFill;		// frames gathered toward the next hop
+
+} stftVocoder;
+
+stftVocoder g_stftVocoder;
+
+/*
+ * The STFT buffers fill most of the otherwise unused ITC bank,
+ * which the M7 reads as fast as the DTC.
+ */
+__BSS(SRAM_ITC) float stftWindow[kStft_Frame_Length];
+__BSS(SRAM_ITC) float stftVoiceIn[kStft_Frame_Length];
+__BSS(SRAM_ITC) float stftCarrierIn[kStft_Frame_Length];
+__BSS(SRAM_ITC) float stftWork[kStft_Frame_Length];
+__BSS(SRAM_ITC) float stftVoiceSpectrum[kStft_Frame_Length];
+__BSS(SRAM_ITC) float stftCarrierSpectrum[kStft_Frame_Length];
+__BSS(SRAM_ITC) float stftOverlap[kStft_Frame_Length];
+__BSS(SRAM_ITC) float stftOutput[kStft_Hop];
+
+void initStftVocoder(stftVocoder *stft, uint32_t numBands, float minHz, float maxHz);
+void setStftBands(stftVocoder *stft, uint32_t numBands, float minHz, float maxHz);
+void resetStftVocoder(stftVocoder *stft);
+void runStftFrame(stftVocoder *stft);
+void processStftBlock(stftVocoder *stft, const int32_t *in, int32_t *out, size_t frames);
+
+
+/*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*
+ *~*~*  F I X E D   E N G I N E  *~*~*
+ *~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*~*/
+
+/*
+ * The Q31 engine runs the biquad engine's stages in fixed point: the
+ * voice decimator, sibilance, analysis, envelope and shaping filters.
+ * Every biquad runs on the CMSIS 32x64 kernel, whose 64-bit state keeps
+ * the narrow low bands accurate at the full rate, so there is no octave
+ * tree. Its cycle count doesn't depend on the signal, and it leaves the
+ * FPU to the synth.
+ *
+ * Samples are 24-bit audio shifted up kFixed_Input_Shift bits, leaving a
+ * bit of headroom. Biquad coefficients are stored at half scale so that
+ * |a1| up to 2 fits, and the kernel shifts back by kFixed_Post_Shift.
+ *
+ * Each band's Q31 by Q31 product can reach 2^62, so it is shifted down
+ * kFixed_Band_Headroom bits before going into the 64-bit mix, leaving
+ * room for kVocoder_Max_Bands of them. The rest of kFixed_Mix_Shift
+ * comes off the sum.
+ */
+enum _speakEZ_fixed_constants {
+	kFixed_Input_Shift	= 7,
+	kFixed_Post_Shift	= 1,
+	kFixed_Mix_Shift	= 28,	// takes the band sum (Q31 by Q31) down to 24-bit audio
+	kFixed_Band_Headroom = 5,	// log2(kVocoder_Max_Bands)
+	kFixed_Output_Max	= 8388607,
+	kFixed_Output_Min	= -8388608
+};
+
+/*
+ * fixedVocoder Structure
+ *
+ * State of the Q31 engine. It follows the band layout of the active
+ * vocoderConfig, but always with the biquad envelope follower, whose
+ * numerators carry VOCODER_MIX_GAIN and each band's output gain.
+ *
+ * Each stage counts the samples it had to clip, so level problems
+ * show up without a debugger in the loop.
+ */
+typedef struct fixedVocoder {
+
+	uint32_t numBands;
+
+	arm_fir_decimate_instance_q31 decimator;
+	q31_t decimatorCarry[kResample_Downsample_Rate];
+	uint32_t decimatorCarryCount;
+
+	arm_biquad_cas_df1_32x64_ins_q31 sibilance;
+	arm_biquad_cas_df1_32x64_ins_q31 analysis[kVocoder_Max_Bands];
+	arm_biquad_cas_df1_32x64_ins_q31 follower[kVocoder_Max_Bands];
+	arm_biquad_cas_df1_32x64_ins_q31 shaping[kVocoder_Max_Bands];
+	q31_t envelope[kVocoder_Max_Bands];		// each band's envelope at the last tick
+
+	uint32_t inputSaturations;		// voice and synth samples clipped going into Q31
+	uint32_t mixSaturations;		// band sums clipped to Q31
+	uint32_t outputSaturations;		// output samples clipped to 24 bits
+
+} fixedVocoder;
+
+/*
+ * The biquad kernels only touch their coefficients and state once a
+ * call, so those live in the roomy non-cacheable bank. The decimator's
+ * delay line and the per-block scratch are read every sample, and go
+ * in the cached OCRAM.
+ */
+__BSS(NCACHE_REGION) fixedVocoder g_fixedVocoder;
+__BSS(NCACHE_REGION) q31_t fixedSibilanceCoeffs[5];
+__BSS(NCACHE_REGION) q63_t fixedSibilanceState[4];
+__BSS(NCACHE_REGION) q31_t fixedAnalysisCoeffs[kVocoder_Max_Bands * 5];
+__BSS(NCACHE_REGION) q63_t fixedAnalysisStates[kVocoder_Max_Bands][4];
+__BSS(NCACHE_REGION) q31_t fixedFollowerCoeffs[kVocoder_Max_Bands * 5];
+__BSS(NCACHE_REGION) q63_t fixedFollowerStates[kVocoder_Max_Bands][4];
+__BSS(NCACHE_REGION) q31_t fixedShapingCoeffs[kVocoder_Max_Bands * 5];
+__BSS(NCACHE_REGION) q63_t fixedShapingStates[kVocoder_Max_Bands][4];
+
+__BSS(SRAM_OC) q31_t fixedDecimatorCoeffs[kVoxDecimator_Taps];
+__BSS(SRAM_OC) q31_t fixedDecimatorState[kVoxDecimator_Taps + kVoxDecimator_Max_Input - 1];
+__BSS(SRAM_OC) q31_t fixedVoice[kVoxDecimator_Max_Input + kResample_Downsample_Rate];	// carried frames, then the block
+__BSS(SRAM_OC) q31_t fixedCarrier[kAudio_Block_Frames];
+__BSS(SRAM_OC) q31_t fixedSibilance[kAudio_Block_Frames];
+__BSS(SRAM_OC) q31_t fixedBand[kAudio_Block_Frames];
+__BSS(SRAM_OC) q63_t fixedMix[kAudio_Block_Frames];
+
+void convertBiquadCoeffsQ31(const float *coeffs, float gain, q31_t *fixedCoeffs);
+q31_t toFixedSample(int32_t sample, uint32_t *saturations);
+void initFixedVocoder(fixedVocoder *fx, const vocoderConfig *cfg);
+void setFixedBands(fixedVocoder *fx, const vocoderConfig *cfg);
+void resetFixedVocoder(fixedVocoder *fx);
+void processFixedBlock(fixedVocoder *fx, const int32_t *in, int32_t *out, size_t frames);
+
+void setVocoderEngine(vocoder_engine_t engine);
+uint32_t getVocoderLatencyFrames(void);
+
+
+#if SPEAKEZ_BENCHMARK
+#define BENCHMARK_BLOCKS		64U
+
+/*
+ * The scalar, band-at-a-time shaping filters the bank replaced,
+ * kept only so the benchmark has something to compare against.
+ */
+float shapingReferenceInputs[2] 					= {0};
+float shapingReferenceOutputs[NUM_VOCODER_BANDS][2] = {0};
+float shapingReferenceBlock[NUM_VOCODER_BANDS][kAudio_Block_Frames] = {0};
+float shapingReferenceCoeffs[NUM_VOCODER_BANDS * 5]	= {0};
+void runShapingReferenceBlock(const float *newInputs, uint32_t frames, float *coeffs);
+
+void runBenchmarks(void);
+#endif
 
 #endif /* SPEAKEZ_H_ */
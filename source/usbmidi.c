@@ -80,7 +80,7 @@ void USB_HostTaskFn(void *param) {
  */
 static void midiControlCallback(void *param, uint8_t *data, uint32_t dataLength, usb_status_t status)
 {
-	usb_host_cdc_instance_struct_t *callbackInstance = (usb_host_cdc_instance_struct_t *)param;
+	usbmidi_host_instance_t *callbackInstance = (usbmidi_host_instance_t *)param;
 
     if (kStatus_USB_TransferStall == status)
     {
@@ -111,55 +111,56 @@ static void midiControlCallback(void *param, uint8_t *data, uint32_t dataLength,
 
 }
 
+/*
+ * midiQueuePop
+ *
+ * Consumer side. Takes the oldest event packet off the queue the class
+ * driver fills, with the time it was received, returning 0 if there is
+ * none.
+ */
+_Bool midiQueuePop(usb_host_midi_packet_ring_t *queue, usbmidi_event_packet_t *event, uint32_t *time)
+{
+	uint32_t packet;
+
+	if(!USB_HostMidiRingPop(queue, &packet, time)) return 0;
+
+	event->CCIN = (uint8_t)packet;
+	event->MIDI_0 = (uint8_t)(packet >> 8);
+	event->MIDI_1 = (uint8_t)(packet >> 16);
+	event->MIDI_2 = (uint8_t)(packet >> 24);
+
+	return 1;
+}
+
 /*!
- * @brief midi interrupt receive callback (adapted from host_hid_generic_bm example)
+ * @brief midi stream callback
  *
- * This function is used as callback function for interrupt transfer. Interrupt transfer is used to implement
- * asynchronous MIDI requests and reads, allowing the rest of our program flow.
- * @param param    the host cdc instance pointer.
- * @param data     data buffer pointer.
- * @param dataLength data length.
+ * The class driver has already queued the received event packets on
+ * g_demoMidiEventQueue and put the buffer back on the pipe, so there is
+ * only work to do when a transfer fails. Runs from USB_HostTaskFn, in the
+ * program loop.
+ *
+ * @param param    the host app midi instance pointer.
+ * @param packetCount number of event packets queued.
  * @status         transfer result status.
  */
-static void midiInterruptRecvCallback(void *param, uint8_t *data, uint32_t dataLength, usb_status_t status)
+static void midiStreamCallback(void *param, uint32_t packetCount, usb_status_t status)
 {
-	usb_host_cdc_instance_struct_t *callbackInstance = (usb_host_cdc_instance_struct_t *)param;
-	//usbmidi_event_packet_t *state = (usbmidi_event_packet_t *)data;
+	usbmidi_host_instance_t *callbackInstance = (usbmidi_host_instance_t *)param;
+
+	if(status == kStatus_USB_Success) return;
 
-	if(status)
+	if(status == kStatus_USB_TransferCancel)
 	{
-	    if(status == kStatus_USB_TransferCancel)
-	    {
-	        PRINTF("!! ERROR: Data transfer cancelled !!\n");
-	    }
-	    else
-	    {
-	        //PRINTF("!! MIDI data transfer error !!\n"); //Comment out to avoid clicks on timeouts between presses/releases
-	    }
+		PRINTF("!! ERROR: Data transfer cancelled !!\n");
 	}
-	else
+
+	/* re-prime whichever buffer dropped off the pipe */
+	if((callbackInstance->runWaitState == kUSBMIDIRunState_WaitListening) &&
+	   (callbackInstance->deviceState == kStatus_DEV_Attached))
 	{
-		g_demoMidiPacketRecvFlag = 1;
-	    //PRINTF("\nCable Number and CIN = 0x%x\n", state->cableAndCIN);
-	    //PRINTF("First MIDI Event Byte = 0x%x\n", state->MIDI_0);
-	    //PRINTF("Second MIDI Event Byte = 0x%x\n", state->MIDI_1);
-	    //PRINTF("Third MIDI Event Byte = 0x%x\n", state->MIDI_2);
+		callbackInstance->runState = kUSBMIDIRunState_PrimeListening;
 	}
-
-    if(callbackInstance->runWaitState == kUSBMIDIRunState_WaitListening)
-    {
-        if(status == kStatus_USB_Success)
-        {
-            callbackInstance->runState = kUSBMIDIRunState_Listening;
-        }
-        else
-        {
-            if(callbackInstance->deviceState == kStatus_DEV_Attached)
-            {
-                callbackInstance->runState = kUSBMIDIRunState_PrimeListening;
-            }
-        }
-    }
 }
 
 
@@ -175,7 +176,7 @@ static void midiInterruptRecvCallback(void *param, uint8_t *data, uint32_t dataL
 void USB_HostMidiTask(void *param)
 {
     usb_status_t status = kStatus_USB_Success;
-    usb_host_cdc_instance_struct_t *midiInstance = (usb_host_cdc_instance_struct_t *)param;
+    usbmidi_host_instance_t *midiInstance = (usbmidi_host_instance_t *)param;
 
     /* device state changes */
     if(midiInstance->deviceState != midiInstance->prevState)
@@ -187,15 +188,15 @@ void USB_HostMidiTask(void *param)
                 break;
             case kStatus_DEV_Attached:
                 midiInstance->runState = kUSBMIDIRunState_SetInterfaces;
-                status = USB_HostCdcInit(midiInstance->deviceHandle, &midiInstance->classHandle);
+                status = USB_HostMidiInit(midiInstance->deviceHandle, &midiInstance->classHandle);
                 PRINTF("Audio device attached...status code (0x%x)\n", status);
                 break;
             case kStatus_DEV_Detached:
                 midiInstance->deviceState = kStatus_DEV_Idle;
                 midiInstance->runState = kUSBMIDIRunState_Idle;
-                status = USB_HostCdcDeinit(midiInstance->deviceHandle, midiInstance->classHandle);
+                status = USB_HostMidiDeinit(midiInstance->deviceHandle, midiInstance->classHandle);
                 midiInstance->controlInterfaceHandle = NULL;
-                midiInstance->dataInterfaceHandle = NULL;
+                midiInstance->streamingInterfaceHandle = NULL;
                 midiInstance->classHandle = NULL;
                 midiInstance->deviceHandle = NULL;
                 PRINTF("Audio device detached...status code (0x%x)\n\n", status);
@@ -216,26 +217,22 @@ void USB_HostMidiTask(void *param)
 
 
             PRINTF("Setting interfaces...\n");
-            if(USB_HostCdcSetControlInterface(midiInstance->classHandle, midiInstance->controlInterfaceHandle, 0,
-                    midiControlCallback, midiInstance))
-            {
-                PRINTF("\n!! Error setting control interface !!\n");
-            }
-            if(USB_HostCdcSetDataInterface(midiInstance->classHandle, midiInstance->dataInterfaceHandle, 0,
-            		midiControlCallback, midiInstance))
+            if(USB_HostMidiSetInterface(midiInstance->classHandle, midiInstance->controlInterfaceHandle,
+            		midiInstance->streamingInterfaceHandle, 0, midiControlCallback, midiInstance))
             {
-                PRINTF("\n!! Error setting data interface !!\n");
+                PRINTF("\n!! Error setting MIDI streaming interface !!\n");
             }
             break;
         case kUSBMIDIRunState_SetPacketInfo:
         	midiInstance->runWaitState = kUSBMIDIRunState_WaitListening;
         	midiInstance->runState = kUSBMIDIRunState_Listening;
 
-        	PRINTF("Setting up packet info...\n");
-        	midiInstance->bulkInPacketSize =
-        			USB_HostCdcGetPacketsize(midiInstance->classHandle, USB_ENDPOINT_BULK, USB_IN);
-        	midiInstance->bulkOutPacketSize =
-        			USB_HostCdcGetPacketsize(midiInstance->classHandle, USB_ENDPOINT_BULK, USB_OUT);
+        	PRINTF("MIDI IN: %d byte packets, %d cable(s)...\n",
+        			USB_HostMidiGetPacketsize(midiInstance->classHandle, USB_IN),
+        			USB_HostMidiGetCableCount(midiInstance->classHandle, USB_IN));
+        	PRINTF("MIDI OUT: %d byte packets, %d cable(s)...\n",
+        			USB_HostMidiGetPacketsize(midiInstance->classHandle, USB_OUT),
+        			USB_HostMidiGetCableCount(midiInstance->classHandle, USB_OUT));
         	break;
         case kUSBMIDIRunState_SetProtocol:
         	midiInstance->runWaitState = kUSBMIDIRunState_WaitListening;
@@ -247,10 +244,8 @@ void USB_HostMidiTask(void *param)
         case kUSBMIDIRunState_Listening:
             midiInstance->runWaitState = kUSBMIDIRunState_WaitListening;
             midiInstance->runState = kUSBMIDIRunState_Idle;
-
-            status = USB_HostCdcDataRecv(midiInstance->classHandle, (uint8_t *)&g_demoMidiEventPacket,
-            					sizeof(g_demoMidiEventPacket), midiInterruptRecvCallback,
-								midiInstance);
+            status = USB_HostMidiStreamStart(midiInstance->classHandle, &g_demoMidiEventQueue,
+            		midiStreamCallback, midiInstance);
             if(status) PRINTF("Error in data receive, status code (0x%x)\n", status);
             break;
         case kUSBMIDIRunState_PrimeListening:
@@ -309,7 +304,7 @@ usb_status_t USB_HostMidiEvent(usb_device_handle deviceHandle,
                 		 (interface->interfaceDesc->bInterfaceSubClass == USB_AUDIO_SUBCLASS_MIDISTREAMING))
                 {
                 	PRINTF("Interface (0x%x) is a MIDI Streaming interface.\n\n", interface->interfaceIndex);
-                	g_demoMidiInstance.dataInterfaceHandle = interface;
+                	g_demoMidiInstance.streamingInterfaceHandle = interface;
                 }
                 else {
                 	PRINTF("!! Attached USB device is not supported !!\n\n");
@@ -321,7 +316,7 @@ usb_status_t USB_HostMidiEvent(usb_device_handle deviceHandle,
             g_demoMidiInstance.deviceHandle = deviceHandle;
             g_demoMidiInstance.configHandle = configurationHandle;
 
-            if((NULL != g_demoMidiInstance.dataInterfaceHandle) &&
+            if((NULL != g_demoMidiInstance.streamingInterfaceHandle) &&
                (NULL != g_demoMidiInstance.controlInterfaceHandle) &&
 			   (NULL != g_demoMidiInstance.deviceHandle))
             {
@@ -340,7 +335,7 @@ usb_status_t USB_HostMidiEvent(usb_device_handle deviceHandle,
         	if (g_demoMidiInstance.configHandle == configurationHandle) {
 
         	    if ((g_demoMidiInstance.deviceHandle != NULL) &&
-        	        (g_demoMidiInstance.dataInterfaceHandle != NULL) &&
+        	        (g_demoMidiInstance.streamingInterfaceHandle != NULL) &&
 					(g_demoMidiInstance.controlInterfaceHandle != NULL)) {
 
         	        if (g_demoMidiInstance.deviceState == kStatus_DEV_Idle) {
@@ -354,8 +349,6 @@ usb_status_t USB_HostMidiEvent(usb_device_handle deviceHandle,
         	        	USB_HostHelperGetPeripheralInformation(deviceHandle, kUSB_HostGetDeviceAddress, &infoValue);
         	        	PRINTF("address=%d\r\n", infoValue);
 
-        	        	g_demoMidiEventPipeInit.endpointAddress = infoValue;
-
         	        }
         	        else {
         	            PRINTF("The device instance is not idle...\n");
@@ -37,7 +37,7 @@
 
 #define CONTROLLER_ID 						kUSB_ControllerEhci0
 #define USB_HOST_INTERRUPT_PRIORITY 		3U
-#define MIDI_IN_BUFFER_SIZE 				4U
+#define MIDI_EVENT_QUEUE_SIZE				64U	/* events, power of two; four full transfers */
 
 #define USB_AUDIO_CLASS_CODE				0x01
 #define USB_AUDIO_SUBCLASS_UNDEFINED 		0x00
@@ -52,7 +52,7 @@
 #include "usb_host.h"
 #include "fsl_device_registers.h"
 #include "usb_host_ehci.h"
-#include "usb_host_cdc.h"
+#include "usb_host_midi.h"
 #include "usb_host_devices.h"
 #include "board.h"
 #include "fsl_common.h"
@@ -145,6 +145,22 @@ typedef struct _usbmidi_event_packet
 } usbmidi_event_packet_t;
 
 
+/*! @brief host app MIDI device instance, the class driver's own state is behind classHandle */
+typedef struct _usbmidi_host_instance
+{
+	usb_device_handle deviceHandle;						/* attached device */
+	usb_host_configuration_handle configHandle;			/* this instance's related configuration handle */
+	usb_host_class_handle classHandle;					/* usb_host_midi class instance */
+	usb_host_interface_handle controlInterfaceHandle;	/* AUDIOCONTROL interface */
+	usb_host_interface_handle streamingInterfaceHandle;	/* MIDISTREAMING interface */
+
+	uint8_t deviceState;		/* audio device attach/detach status */
+	uint8_t prevState;			/* audio device attach/detach previous status */
+	uint8_t runState;			/* audio application run status */
+	uint8_t runWaitState;		/* audio application wait status, signals need to progress */
+} usbmidi_host_instance_t;
+
+
 /*! @brief host app run status, adapted from the generic host CDC example */
 typedef enum _usb_host_midi_run_state
 {
@@ -330,10 +346,10 @@ typedef enum _usbmidi_midi_ci_authority_level {
 
 /*! @brief USB host generic instance global variable */
 extern usb_host_handle g_demoUSBHostHandle;
-extern usb_host_cdc_instance_struct_t g_demoMidiInstance;
-extern usbmidi_event_packet_t g_demoMidiEventPacket;
-extern usb_host_pipe_init_t g_demoMidiEventPipeInit;
-extern volatile _Bool g_demoMidiPacketRecvFlag;
+extern usbmidi_host_instance_t g_demoMidiInstance;
+extern uint32_t g_demoMidiEventPackets[MIDI_EVENT_QUEUE_SIZE];
+extern uint32_t g_demoMidiEventTimes[MIDI_EVENT_QUEUE_SIZE];
+extern usb_host_midi_packet_ring_t g_demoMidiEventQueue;
 
 
 usb_status_t USB_HostEvent(usb_device_handle deviceHandle,
@@ -348,6 +364,7 @@ usb_status_t USB_HostMidiEvent(usb_device_handle deviceHandle,
                                usb_host_configuration_handle configurationHandle,
                                uint32_t eventCode);
 void USB_HostMidiTask(void *param);
+_Bool midiQueuePop(usb_host_midi_packet_ring_t *queue, usbmidi_event_packet_t *event, uint32_t *time);
 
 
 #endif /* USBMIDI_H_ */
@@ -0,0 +1,229 @@
+/*
+ * cmsis_dsp_host.c
+ *
+ * Host builds of the CMSIS-DSP kernels the tests reach, so they run
+ * without the library, which isn't part of this tree. Each follows the
+ * portable C of CMSIS-DSP V1.6.0, the release CMSIS/arm_math.h comes
+ * from, down to its rounding and saturation; only the loop unrolling
+ * is left out, which doesn't change the arithmetic. The sine table is
+ * filled on first use instead of being stored.
+ *
+ * Set CMSIS_DSP to build the tests against the library's own sources
+ * instead (see the Makefile).
+ */
+
+#include <string.h>
+#include <math.h>
+#include "arm_math.h"
+
+#define mult32x64(a, b)	((((q63_t)((a) & 0x00000000FFFFFFFF) * (b)) >> 32) + ((q63_t)((a) >> 32) * (b)))
+
+static float32_t sinTable[FAST_MATH_TABLE_SIZE + 1];
+static _Bool sinTableFilled = 0;
+
+
+/*
+ * sinCycle
+ *
+ * arm_sin_f32 and arm_cos_f32 on a value in cycles, interpolated
+ * linearly between the points of sinTable.
+ */
+static float32_t sinCycle(float32_t in, _Bool negative) {
+
+	if(!sinTableFilled) {
+		for(uint32_t i = 0; i <= FAST_MATH_TABLE_SIZE; i++) {
+			sinTable[i] = (float32_t)sin(2.0 * M_PI * i / FAST_MATH_TABLE_SIZE);
+		}
+		sinTableFilled = 1;
+	}
+
+	int32_t n = (int32_t)in;
+	if(negative) {
+		n--;
+	}
+	in = in - (float32_t)n;
+
+	float32_t findex = (float32_t)FAST_MATH_TABLE_SIZE * in;
+	if(findex >= (float32_t)FAST_MATH_TABLE_SIZE) {
+		findex -= (float32_t)FAST_MATH_TABLE_SIZE;
+	}
+
+	uint16_t index = ((uint16_t)findex) & 0x1ff;
+	float32_t fract = findex - (float32_t)index;
+
+	return (1.0f - fract) * sinTable[index] + fract * sinTable[index + 1];
+}
+
+float32_t arm_sin_f32(float32_t x) {
+
+	return sinCycle(x * 0.159154943092f, x < 0.0f);
+}
+
+float32_t arm_cos_f32(float32_t x) {
+
+	float32_t in = x * 0.159154943092f + 0.25f;
+	return sinCycle(in, in < 0.0f);
+}
+
+void arm_copy_q31(const q31_t *pSrc, q31_t *pDst, uint32_t blockSize) {
+
+	while(blockSize--) {
+		*pDst++ = *pSrc++;
+	}
+}
+
+void arm_abs_q31(const q31_t *pSrc, q31_t *pDst, uint32_t blockSize) {
+
+	while(blockSize--) {
+		q31_t in = *pSrc++;
+		*pDst++ = (in > 0) ? in : ((in == INT32_MIN) ? INT32_MAX : -in);
+	}
+}
+
+/* Truncates, as the library does without ARM_MATH_ROUNDING */
+void arm_float_to_q31(const float32_t *pSrc, q31_t *pDst, uint32_t blockSize) {
+
+	while(blockSize--) {
+		*pDst++ = clip_q63_to_q31((q63_t)(*pSrc++ * 2147483648.0f));
+	}
+}
+
+arm_status arm_fir_decimate_init_f32(arm_fir_decimate_instance_f32 *S, uint16_t numTaps, uint8_t M,
+		const float32_t *pCoeffs, float32_t *pState, uint32_t blockSize) {
+
+	if((blockSize % M) != 0U) {
+		return ARM_MATH_LENGTH_ERROR;
+	}
+
+	S->numTaps = numTaps;
+	S->pCoeffs = pCoeffs;
+	memset(pState, 0, (numTaps + (blockSize - 1U)) * sizeof(float32_t));
+	S->pState = pState;
+	S->M = M;
+
+	return ARM_MATH_SUCCESS;
+}
+
+arm_status arm_fir_decimate_init_q31(arm_fir_decimate_instance_q31 *S, uint16_t numTaps, uint8_t M,
+		const q31_t *pCoeffs, q31_t *pState, uint32_t blockSize) {
+
+	if((blockSize % M) != 0U) {
+		return ARM_MATH_LENGTH_ERROR;
+	}
+
+	S->numTaps = numTaps;
+	S->pCoeffs = pCoeffs;
+	memset(pState, 0, (numTaps + (blockSize - 1U)) * sizeof(q31_t));
+	S->pState = pState;
+	S->M = M;
+
+	return ARM_MATH_SUCCESS;
+}
+
+/* The coefficients are time-reversed and the state runs oldest first, as in the library */
+void arm_fir_decimate_q31(const arm_fir_decimate_instance_q31 *S, const q31_t *pSrc, q31_t *pDst, uint32_t blockSize) {
+
+	q31_t *pState = S->pState;
+	q31_t *pStateCurnt = S->pState + (S->numTaps - 1U);
+
+	for(uint32_t blkCnt = blockSize / S->M; blkCnt > 0U; blkCnt--) {
+
+		for(uint32_t i = S->M; i > 0U; i--) {
+			*pStateCurnt++ = *pSrc++;
+		}
+
+		q63_t sum0 = 0;
+		for(uint32_t k = 0; k < S->numTaps; k++) {
+			sum0 += (q63_t)pState[k] * S->pCoeffs[k];
+		}
+
+		pState = pState + S->M;
+		*pDst++ = (q31_t)(sum0 >> 31);
+	}
+
+	/* Keep the last numTaps - 1 samples for the next call */
+	memmove(S->pState, pState, (S->numTaps - 1U) * sizeof(q31_t));
+}
+
+arm_status arm_fir_interpolate_init_f32(arm_fir_interpolate_instance_f32 *S, uint8_t L, uint16_t numTaps,
+		const float32_t *pCoeffs, float32_t *pState, uint32_t blockSize) {
+
+	if((numTaps % L) != 0U) {
+		return ARM_MATH_LENGTH_ERROR;
+	}
+
+	S->pCoeffs = pCoeffs;
+	S->L = L;
+	S->phaseLength = numTaps / L;
+	memset(pState, 0, (blockSize + ((uint32_t)S->phaseLength - 1U)) * sizeof(float32_t));
+	S->pState = pState;
+
+	return ARM_MATH_SUCCESS;
+}
+
+void arm_biquad_cas_df1_32x64_init_q31(arm_biquad_cas_df1_32x64_ins_q31 *S, uint8_t numStages,
+		const q31_t *pCoeffs, q63_t *pState, uint8_t postShift) {
+
+	S->numStages = numStages;
+	S->pCoeffs = pCoeffs;
+	S->postShift = postShift;
+	memset(pState, 0, (4U * (uint32_t)numStages) * sizeof(q63_t));
+	S->pState = pState;
+}
+
+/*
+ * The feedback terms keep 64 bits, shifted up by postShift + 1; the
+ * output is the top word of the accumulator after the same shift.
+ */
+void arm_biquad_cas_df1_32x64_q31(const arm_biquad_cas_df1_32x64_ins_q31 *S, q31_t *pSrc, q31_t *pDst, uint32_t blockSize) {
+
+	const q31_t *pCoeffs = S->pCoeffs;
+	q63_t *pState = S->pState;
+	q31_t *pIn = pSrc;
+	uint32_t uShift = ((uint32_t)S->postShift + 1U);
+	uint32_t lShift = 32U - uShift;
+
+	for(uint32_t stage = S->numStages; stage > 0U; stage--) {
+
+		q31_t b0 = *pCoeffs++;
+		q31_t b1 = *pCoeffs++;
+		q31_t b2 = *pCoeffs++;
+		q31_t a1 = *pCoeffs++;
+		q31_t a2 = *pCoeffs++;
+
+		q31_t Xn1 = (q31_t)pState[0];
+		q31_t Xn2 = (q31_t)pState[1];
+		q63_t Yn1 = pState[2];
+		q63_t Yn2 = pState[3];
+
+		q31_t *pOut = pDst;
+
+		for(uint32_t n = 0; n < blockSize; n++) {
+
+			q31_t Xn = *pIn++;
+
+			q63_t acc = (q63_t)Xn * b0;
+			acc += (q63_t)Xn1 * b1;
+			acc += (q63_t)Xn2 * b2;
+			acc += mult32x64(Yn1, a1);
+			acc += mult32x64(Yn2, a2);
+
+			Xn2 = Xn1;
+			Xn1 = Xn;
+			Yn2 = Yn1;
+			Yn1 = (q63_t)((uint64_t)acc << uShift);
+
+			uint32_t acc_l = (uint32_t)acc;
+			uint32_t acc_h = (uint32_t)((uint64_t)acc >> 32);
+			*pOut++ = (q31_t)((acc_l >> lShift) | (acc_h << uShift));
+		}
+
+		/* The next stage works on this one's output */
+		pIn = pDst;
+
+		*pState++ = (q63_t)Xn1;
+		*pState++ = (q63_t)Xn2;
+		*pState++ = Yn1;
+		*pState++ = Yn2;
+	}
+}
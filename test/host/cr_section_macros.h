@@ -0,0 +1,15 @@
+/*
+ * cr_section_macros.h
+ *
+ * Host stand-in for the MCUXpresso section macros. The memory banks
+ * only exist on the target, so everything lands in the host's .bss.
+ */
+
+#ifndef CR_SECTION_MACROS_H_
+#define CR_SECTION_MACROS_H_
+
+#define __BSS(bank)
+#define __DATA(bank)
+#define __RODATA(bank)
+
+#endif /* CR_SECTION_MACROS_H_ */
@@ -0,0 +1,27 @@
+/*
+ * host_cmsis.h
+ *
+ * Force-included ahead of every host test build. Pulls in the CMSIS
+ * GCC intrinsics with the Cortex-M memory barriers renamed out of the
+ * way, then maps the barriers onto the host's full fence, so the
+ * firmware sources compile for x86 unchanged.
+ */
+
+#ifndef HOST_CMSIS_H_
+#define HOST_CMSIS_H_
+
+#include <stdint.h>
+
+#define __ISB __cmsis_ISB
+#define __DSB __cmsis_DSB
+#define __DMB __cmsis_DMB
+#include "cmsis_gcc.h"
+#undef __ISB
+#undef __DSB
+#undef __DMB
+
+#define __ISB()		__sync_synchronize()
+#define __DSB()		__sync_synchronize()
+#define __DMB()		__sync_synchronize()
+
+#endif /* HOST_CMSIS_H_ */
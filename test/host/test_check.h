@@ -0,0 +1,26 @@
+/*
+ * test_check.h
+ *
+ * The one assertion the host tests share. A failed check is reported
+ * and counted rather than aborting, so one run shows every failure.
+ */
+
+#ifndef TEST_CHECK_H_
+#define TEST_CHECK_H_
+
+#include <stdio.h>
+
+static uint32_t g_testFailures = 0;
+
+#define TEST_CHECK(cond, ...) do {							\
+		if(!(cond)) {										\
+			printf("FAIL %s:%d: ", __FILE__, __LINE__);		\
+			printf(__VA_ARGS__);							\
+			printf("\n");									\
+			g_testFailures++;								\
+		}													\
+	} while(0)
+
+#define TEST_RESULT(name)	(printf("%s: %s\n", (name), g_testFailures ? "FAILED" : "passed"), g_testFailures ? 1 : 0)
+
+#endif /* TEST_CHECK_H_ */
@@ -0,0 +1,277 @@
+/*
+ * test_fixed_vocoder.c
+ *
+ * Runs the Q31 engine on a synthetic voice and synth chord beside a
+ * double-precision model of the same stages, with the same float
+ * coefficients, and checks the SNR of its output against the model.
+ *
+ * Then stacks every band of a full layout on one tone, each band's
+ * envelope near full scale, so the band sum overflows Q31 several times
+ * over, and checks the output saturates to the model's rail and is
+ * counted, rather than wrapping.
+ */
+#define main speakEZ_main
+#include "speakEZ.c"
+#undef main
+
+#include "test_check.h"
+
+enum _test_fixed_vocoder {
+	kTest_Blocks		= 4000U,	// close to three seconds
+	kTest_Hot_Blocks	= 500U,
+	kTest_Min_Snr_dB	= 90U,
+	kTest_Tone_Key		= 83U	// B5, near 1 kHz
+};
+
+#define TEST_HOT_ENVELOPE	0.5	// of Q31 full scale
+
+static int16_t sawLevel[kSynth_Table_Length];
+static int16_t sineLevel[kSynth_Table_Length];
+static wavetableMipmap sawTable;
+static wavetableMipmap sineTable;
+
+
+/*
+ * biquadModel Structure
+ *
+ * A DF1 biquad in double precision, for the model.
+ */
+typedef struct biquadModel {
+
+	double x1, x2, y1, y2;
+
+} biquadModel;
+
+/*
+ * vocoderModel Structure
+ *
+ * The Q31 engine's stages in double precision, run a frame at a time
+ * on 24-bit sample values.
+ */
+typedef struct vocoderModel {
+
+	uint32_t frame;
+	double voice[kVoxDecimator_Taps + kResample_Downsample_Rate - 1];	// newest last
+	biquadModel sibilance;
+	biquadModel analysis[kVocoder_Max_Bands];
+	biquadModel follower[kVocoder_Max_Bands];
+	biquadModel shaping[kVocoder_Max_Bands];
+	float shapingCoeffs[kVocoder_Max_Bands][5];
+	double envelope[kVocoder_Max_Bands];
+
+} vocoderModel;
+
+static vocoderModel model;
+
+
+static double runBiquadModel(biquadModel *f, const float *coeffs, double gain, double x) {
+
+	double y = gain * (coeffs[0] * x + coeffs[1] * f->x1 + coeffs[2] * f->x2) - coeffs[3] * f->y1 - coeffs[4] * f->y2;
+
+	f->x2 = f->x1;
+	f->x1 = x;
+	f->y2 = f->y1;
+	f->y1 = y;
+
+	return y;
+}
+/*
+ * resetModel
+ *
+ * Starts the model from silence on the bands of cfg, with the shaping
+ * filters at the full rate, as setFixedBands makes them.
+ */
+static void resetModel(const vocoderConfig *cfg) {
+
+	memset(&model, 0, sizeof(model));
+
+	for(uint32_t b = 0; b < cfg->numBands; b++) {
+		calculateBiquadCoeffs(model.shapingCoeffs[b], cfg->f0[b], (float)kAudio_Frame_Hz, kFilter_Band_Pass, cfg->shapingBW[b]);
+	}
+}
+/*
+ * runModel
+ *
+ * Runs one frame of voice and carrier through the model. The bands'
+ * envelopes move on once each tick's last input has arrived, and hold
+ * until the next, as the Q31 engine's segments do. Like
+ * arm_fir_decimate_q31, a tick's output is the filter at the first of
+ * its inputs; the rest only come in on the next tick.
+ */
+static double runModel(const vocoderConfig *cfg, double voice, double carrier) {
+
+	memmove(model.voice, &model.voice[1], (kVoxDecimator_Taps + kResample_Downsample_Rate - 2) * sizeof(double));
+	model.voice[kVoxDecimator_Taps + kResample_Downsample_Rate - 2] = voice;
+
+	if((model.frame++ % kResample_Downsample_Rate) == kResample_Downsample_Rate - 1) {
+
+		double downsampled = 0;
+		for(uint32_t k = 0; k < kVoxDecimator_Taps; k++) {
+			downsampled += voxDecimatorCoeffs[k] * model.voice[k];
+		}
+
+		for(uint32_t b = 0; b < cfg->numBands; b++) {
+			double band = runBiquadModel(&model.analysis[b], &cfg->analysisCoeffs[b * 5], 1.0, downsampled);
+			model.envelope[b] = runBiquadModel(&model.follower[b], envelopeFollowerCoeffs,
+					VOCODER_MIX_GAIN * cfg->outputGain[b], fabs(band));
+		}
+	}
+
+	double out = runBiquadModel(&model.sibilance, sibilanceBiquadCoeffs, 1.0, voice);
+	for(uint32_t b = 0; b < cfg->numBands; b++) {
+		out += runBiquadModel(&model.shaping[b], model.shapingCoeffs[b], 1.0, carrier) * model.envelope[b];
+	}
+
+	if(out > kFixed_Output_Max) out = kFixed_Output_Max;
+	if(out < kFixed_Output_Min) out = kFixed_Output_Min;
+
+	return out;
+}
+/*
+ * testVoice
+ *
+ * A vowel at a gliding pitch, in syllables, with a hiss every second
+ * for the sibilance path. Deterministic, so runs compare.
+ */
+static int32_t testVoice(uint32_t frame, float level) {
+
+	static uint32_t noise = 1;
+	double t = (double)frame / kAudio_Frame_Hz;
+	double pitch = 130.0 + 30.0 * sin(2 * PI * 0.4 * t);
+	double syllable = 0.5 + 0.5 * sin(2 * PI * 3.0 * t);
+	double vowel = 0;
+
+	for(uint32_t h = 1; h <= 20; h++) {
+		vowel += sin(2 * PI * h * pitch * t + h) / h;
+	}
+
+	noise = noise * 1664525U + 1013904223U;
+	double hiss = (fmod(t, 1.0) > 0.8) ? ((int32_t)noise >> 8) / 8388608.0 : 0;
+
+	return (int32_t)(level * kFixed_Output_Max * (0.1 * syllable * syllable * vowel + 0.1 * hiss));
+}
+/*
+ * testTone
+ *
+ * A steady tone at the frequency of kTest_Tone_Key.
+ */
+static int32_t testTone(uint32_t frame, float level) {
+
+	double t = (double)frame / kAudio_Frame_Hz;
+
+	return (int32_t)(level * kFixed_Output_Max * sin(2 * PI * g_demoSynth.freq[kTest_Tone_Key] * t));
+}
+/*
+ * runEngines
+ *
+ * Runs blocks of test voice through the Q31 engine and the model on the
+ * bands of cfg, with the synth as carrier. Adds the model's output
+ * power and the error's into signal and noise, and returns the number of
+ * frames where the model clipped and the engine didn't match its rail.
+ */
+static uint32_t runEngines(const vocoderConfig *cfg, uint32_t blocks, int32_t (*voice)(uint32_t, float), float level,
+		double *signal, double *noise) {
+
+	int32_t in[kAudio_Block_Frames * kAudio_Buffer_Words] = {0};
+	int32_t out[kAudio_Block_Frames * kAudio_Buffer_Words];
+	uint32_t wrongRail = 0;
+
+	for(uint32_t block = 0; block < blocks; block++) {
+
+		for(uint32_t n = 0; n < kAudio_Block_Frames; n++) {
+			in[n * kAudio_Buffer_Words + 1] = voice(block * kAudio_Block_Frames + n, level);
+		}
+
+		processFixedBlock(&g_fixedVocoder, in, out, kAudio_Block_Frames);
+
+		for(uint32_t n = 0; n < kAudio_Block_Frames; n++) {
+
+			/* The engine leaves the synth block it played in fixedCarrier */
+			double expected = runModel(cfg, in[n * kAudio_Buffer_Words + 1], fixedCarrier[n] >> kFixed_Input_Shift);
+			double error = out[n * kAudio_Buffer_Words] - expected;
+
+			*signal += expected * expected;
+			*noise += error * error;
+
+			if((expected == kFixed_Output_Max || expected == kFixed_Output_Min) && out[n * kAudio_Buffer_Words] != expected) {
+				wrongRail++;
+			}
+		}
+	}
+
+	return wrongRail;
+}
+
+int main(void) {
+
+	vocoderConfig *cfg = &g_vocoderConfigs[0];
+	double signal = 0, noise = 0;
+
+	/* The vocoder set up as main does it */
+	initVoxDecimator();
+	calculateBiquadCoeffs(sibilanceBiquadCoeffs, (float)kResample_Sibilance_HP,
+			(float)kAudio_Frame_Hz, kFilter_High_Pass, sibilanceBiquadQ);
+	calculateBiquadCoeffs(envelopeFollowerCoeffs, (float)kResample_Envelope_Freq,
+			(float)kAudio_Frame_Hz / 6, kFilter_Low_Pass, envelopeFollowerQ);
+	setVocoderBands(cfg, NUM_VOCODER_BANDS, bandpassBiquadF0, analysisBiquadBWs, shapingBiquadBWs);
+	buildVocoderConfig(cfg);
+	initFixedVocoder(&g_fixedVocoder, cfg);
+	resetModel(cfg);
+
+	/* A saw chord for the carrier */
+	for(uint32_t n = 0; n < kSynth_Table_Length; n++) {
+		sawLevel[n] = (int16_t)((2 * (int32_t)n - (int32_t)kSynth_Table_Length) * (int32_t)(kSynth_Mip_Full_Scale / kSynth_Table_Length));
+	}
+	for(uint32_t n = 0; n < kSynth_Table_Length; n++) {
+		sineLevel[n] = (int16_t)(kSynth_Mip_Full_Scale * sin(2 * PI * n / kSynth_Table_Length));
+	}
+	for(uint32_t level = 0; level < kSynth_Mip_Levels; level++) {
+		sawTable.level[level] = sawLevel;
+		sineTable.level[level] = sineLevel;
+	}
+	initSynth(&g_demoSynth, kSynth_Num_Keys, kSynth_A3_Index, TONE_A3_HZ, kUSBMIDI_Channel_1);
+	g_demoSynth.wavetable = &sawTable;
+	for(uint32_t i = 0; i < NUM_DEMO_NOTES; i++) {
+		pressKey(&g_demoSynth, demoChords[0][i], 16);
+	}
+
+	/* The startup bands at a speaking level */
+	runEngines(cfg, kTest_Blocks, testVoice, 0.25f, &signal, &noise);
+
+	double snr = 10 * log10(signal / noise);
+	TEST_CHECK(snr >= kTest_Min_Snr_dB, "SNR %.1f dB against the double-precision model", snr);
+	TEST_CHECK(g_fixedVocoder.inputSaturations == 0 && g_fixedVocoder.mixSaturations == 0 && g_fixedVocoder.outputSaturations == 0,
+			"saturated at a speaking level: input %u, mix %u, output %u", g_fixedVocoder.inputSaturations,
+			g_fixedVocoder.mixSaturations, g_fixedVocoder.outputSaturations);
+	printf("startup bands: SNR %.1f dB\n", snr);
+
+	/* Every band on the one tone, voice and carrier alike */
+	for(uint32_t i = 0; i < NUM_DEMO_NOTES; i++) {
+		releaseKey(&g_demoSynth, demoChords[0][i]);
+	}
+	g_demoSynth.wavetable = &sineTable;
+	pressKey(&g_demoSynth, kTest_Tone_Key, kSynth_Max_Velocity);
+
+	float tone = g_demoSynth.freq[kTest_Tone_Key];
+	setVocoderBandsLogSpaced(cfg, kVocoder_Max_Bands, tone, tone, 1.0f, 1.0f);
+	buildVocoderConfig(cfg);
+	initFixedVocoder(&g_fixedVocoder, cfg);
+	resetModel(cfg);
+	runEngines(cfg, kTest_Hot_Blocks, testTone, 0.5f, &signal, &noise);
+
+	/* Then each band's gain set to bring its envelope near full scale */
+	for(uint32_t b = 0; b < kVocoder_Max_Bands; b++) {
+		setVocoderBandGain(cfg, b, TEST_HOT_ENVELOPE * INT32_MAX / g_fixedVocoder.envelope[b]);
+	}
+	buildVocoderConfig(cfg);
+	initFixedVocoder(&g_fixedVocoder, cfg);
+	resetModel(cfg);
+
+	uint32_t wrongRail = runEngines(cfg, kTest_Hot_Blocks, testTone, 0.5f, &signal, &noise);
+
+	TEST_CHECK(g_fixedVocoder.mixSaturations > 0, "the hot layout never overflowed the mix");
+	TEST_CHECK(wrongRail == 0, "%u clipped frames off the model's rail", wrongRail);
+	printf("hot layout: %u mix saturations, %u clipped frames off the rail\n", g_fixedVocoder.mixSaturations, wrongRail);
+
+	return TEST_RESULT("test_fixed_vocoder");
+}
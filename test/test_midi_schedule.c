@@ -0,0 +1,218 @@
+/*
+ * test_midi_schedule.c
+ *
+ * Feeds stamped MIDI events through scheduleMidiBlock and
+ * playScheduledSynthBlock, and checks each is heard from the frame it
+ * was stamped at. A constant wavetable makes every sounding voice add
+ * the same step to the output, so the voice count can be read back
+ * frame by frame. Then checks the late, held and slipped cases.
+ *
+ * The receive queue is stubbed with midiQueuePop below; the events are
+ * applied by the real handleMidiEventPacket.
+ */
+#define main speakEZ_main
+#include "speakEZ.c"
+#undef main
+
+#include "test_check.h"
+
+enum _test_midi_schedule {
+	kTest_Queue_Events	= 32U,
+	kTest_Table_Level	= 1000,
+	kTest_Key			= 60U
+};
+
+static int16_t constantLevel[kSynth_Table_Length];
+static wavetableMipmap constantTable;
+
+static usbmidi_event_packet_t queuedEvent[kTest_Queue_Events];
+static uint32_t queuedTime[kTest_Queue_Events];
+static uint32_t queueHead, queueTail;
+
+
+/*
+ * midiQueuePop
+ *
+ * Stands in for the one in usbmidi.c, taking events off the test's own
+ * queue instead of the class driver's ring.
+ */
+_Bool midiQueuePop(usb_host_midi_packet_ring_t *queue, usbmidi_event_packet_t *event, uint32_t *time) {
+
+	(void)queue;
+
+	if(queueTail == queueHead) return 0;
+
+	*event = queuedEvent[queueTail % kTest_Queue_Events];
+	*time = queuedTime[queueTail % kTest_Queue_Events];
+	queueTail++;
+
+	return 1;
+}
+/*
+ * queueNote
+ *
+ * Queues a note-on (velocity above 0) or note-off for key, stamped at
+ * frame time.
+ */
+static void queueNote(uint32_t key, uint32_t velocity, uint32_t time) {
+
+	usbmidi_event_packet_t event;
+
+	event.CCIN = velocity ? kUSBMIDI_CIN_Note_On : kUSBMIDI_CIN_Note_Off;
+	event.MIDI_0 = (velocity ? 0x90 : 0x80) | g_demoSynth.midiChannel;
+	event.MIDI_1 = (uint8_t)key;
+	event.MIDI_2 = (uint8_t)velocity;
+
+	queuedEvent[queueHead % kTest_Queue_Events] = event;
+	queuedTime[queueHead % kTest_Queue_Events] = time;
+	queueHead++;
+}
+/*
+ * startCase
+ *
+ * Silences the synth and clears the schedule and queue between cases.
+ */
+static void startCase(void) {
+
+	while(g_demoSynth.numActive) {
+		releaseKey(&g_demoSynth, g_demoSynth.activeKeys[0]);
+	}
+	memset(&g_midiSchedule, 0, sizeof(g_midiSchedule));
+	queueHead = queueTail = 0;
+}
+/*
+ * playBlock
+ *
+ * Schedules and renders the block starting at frame time blockStart.
+ */
+static void playBlock(uint32_t blockStart, int32_t *out) {
+
+	scheduleMidiBlock(&g_midiSchedule, NULL, blockStart, kAudio_Block_Frames);
+	playScheduledSynthBlock(&g_demoSynth, &g_midiSchedule, out, kAudio_Block_Frames);
+}
+/*
+ * expectStep
+ *
+ * Adds change to the expected voice count from frame on.
+ */
+static void expectStep(int32_t *voices, uint32_t frame, int32_t change) {
+
+	for(uint32_t n = frame; n < kAudio_Block_Frames; n++) {
+		voices[n] += change;
+	}
+}
+/*
+ * checkVoices
+ *
+ * Checks the voices sounding in each frame of out against voices.
+ * Returns 1 if they all match.
+ */
+static _Bool checkVoices(const char *name, const int32_t *out, const int32_t *voices) {
+
+	double step = SYNTH_MIP_SCALE * kTest_Table_Level;
+
+	for(uint32_t n = 0; n < kAudio_Block_Frames; n++) {
+		int32_t heard = (int32_t)lround(out[n] / step);
+		if(heard != voices[n]) {
+			TEST_CHECK(0, "%s: %d voices at frame %u, expected %d", name, heard, n, voices[n]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int main(void) {
+
+	int32_t out[kAudio_Block_Frames];
+	int32_t voices[kAudio_Block_Frames];
+
+	for(uint32_t n = 0; n < kSynth_Table_Length; n++) {
+		constantLevel[n] = kTest_Table_Level;
+	}
+	for(uint32_t level = 0; level < kSynth_Mip_Levels; level++) {
+		constantTable.level[level] = constantLevel;
+	}
+	initSynth(&g_demoSynth, kSynth_Num_Keys, kSynth_A3_Index, TONE_A3_HZ, kUSBMIDI_Channel_1);
+	g_demoSynth.wavetable = &constantTable;
+
+	/*
+	 * Events at their frames, across the frame clock wrapping, out of
+	 * order, and a note-on and note-off on one frame kept in arrival order
+	 */
+	uint32_t blockStart = 0xFFFFFFF0U;
+	startCase();
+	queueNote(kTest_Key, kSynth_Max_Velocity, blockStart + 0);
+	queueNote(kTest_Key + 1, kSynth_Max_Velocity, blockStart + 17);	// past the wrap
+	queueNote(kTest_Key + 2, kSynth_Max_Velocity, blockStart + 5);
+	queueNote(kTest_Key + 3, kSynth_Max_Velocity, blockStart + 31);
+	queueNote(kTest_Key + 4, kSynth_Max_Velocity, blockStart + 9);
+	queueNote(kTest_Key + 4, 0, blockStart + 9);
+	queueNote(kTest_Key, 0, blockStart + 24);
+	playBlock(blockStart, out);
+
+	memset(voices, 0, sizeof(voices));
+	expectStep(voices, 0, 1);
+	expectStep(voices, 5, 1);
+	expectStep(voices, 17, 1);
+	expectStep(voices, 24, -1);
+	expectStep(voices, 31, 1);
+	checkVoices("exact", out, voices);
+	TEST_CHECK(g_midiSchedule.late == 0 && g_midiSchedule.slipped == 0 && !g_midiSchedule.held,
+			"exact: late %u, slipped %u, held %u", g_midiSchedule.late, g_midiSchedule.slipped, g_midiSchedule.held);
+
+	/* An event stamped in a block already played goes at frame 0, counted late */
+	blockStart = 1000;
+	startCase();
+	queueNote(kTest_Key, kSynth_Max_Velocity, blockStart - 40);
+	queueNote(kTest_Key + 1, kSynth_Max_Velocity, blockStart + 3);
+	playBlock(blockStart, out);
+
+	memset(voices, 0, sizeof(voices));
+	expectStep(voices, 0, 1);
+	expectStep(voices, 3, 1);
+	checkVoices("late", out, voices);
+	TEST_CHECK(g_midiSchedule.late == 1, "late: %u counted late, expected 1", g_midiSchedule.late);
+
+	/* One stamped past the block is held for its own block, and everything behind it waits too */
+	startCase();
+	queueNote(kTest_Key, kSynth_Max_Velocity, blockStart + kAudio_Block_Frames + 7);
+	queueNote(kTest_Key + 1, kSynth_Max_Velocity, blockStart + kAudio_Block_Frames + 20);
+	playBlock(blockStart, out);
+
+	memset(voices, 0, sizeof(voices));
+	checkVoices("held, first block", out, voices);
+	TEST_CHECK(g_midiSchedule.held, "held: the early event was not held");
+
+	playBlock(blockStart + kAudio_Block_Frames, out);
+
+	expectStep(voices, 7, 1);
+	expectStep(voices, 20, 1);
+	checkVoices("held, second block", out, voices);
+	TEST_CHECK(g_midiSchedule.late == 0 && !g_midiSchedule.held, "held: late %u, held %u",
+			g_midiSchedule.late, g_midiSchedule.held);
+
+	/*
+	 * A block's worth of note-offs for silent keys fills the schedule, so
+	 * the note-on behind them slips to frame 0 of the next block
+	 */
+	startCase();
+	for(uint32_t i = 0; i < kMidi_Schedule_Events; i++) {
+		queueNote(kTest_Key + 10 + i, 0, blockStart + 10);
+	}
+	queueNote(kTest_Key, kSynth_Max_Velocity, blockStart + 12);
+	playBlock(blockStart, out);
+
+	memset(voices, 0, sizeof(voices));
+	checkVoices("slipped, first block", out, voices);
+	TEST_CHECK(g_midiSchedule.slipped == 1, "slipped: %u counted slipped, expected 1", g_midiSchedule.slipped);
+
+	playBlock(blockStart + kAudio_Block_Frames, out);
+
+	expectStep(voices, 0, 1);
+	checkVoices("slipped, second block", out, voices);
+	TEST_CHECK(g_midiSchedule.late == 0 && !g_midiSchedule.held, "slipped: late %u, held %u",
+			g_midiSchedule.late, g_midiSchedule.held);
+
+	return TEST_RESULT("test_midi_schedule");
+}
@@ -0,0 +1,111 @@
+/*
+ * test_synth_phase.c
+ *
+ * Checks the oscillator phase accumulator against an exact phase, for
+ * every key over kTest_Seconds of playback. The fixed-point accumulator
+ * must stay within its truncation bound, and beat the float accumulator
+ * it replaced, which loses precision as the phase grows.
+ */
+#define main speakEZ_main
+#include "speakEZ.c"
+#undef main
+
+#include "test_check.h"
+
+#if !SYNTH_FIXED_POINT_PHASE
+#error "test_synth_phase checks the SYNTH_FIXED_POINT_PHASE accumulator"
+#endif
+
+enum _test_synth_phase {
+	kTest_Seconds = 10U
+};
+
+#define PHASE_ONE		((double)(1U << SYNTH_PHASE_FRAC_BITS))	// one table sample of fixed-point phase
+
+static const int16_t silentLevel[kSynth_Table_Length];	// only the phases are checked
+static wavetableMipmap silentTable;
+
+/*
+ * phaseDistance
+ *
+ * Returns the distance between two phases in table samples, the short
+ * way around the table.
+ */
+static double phaseDistance(double a, double b) {
+
+	double d = fmod(fabs(a - b), kSynth_Table_Length);
+
+	return d > kSynth_Table_Length / 2 ? kSynth_Table_Length - d : d;
+}
+/*
+ * floatPhaseAfter
+ *
+ * Runs the float accumulator playSynthBlock used before
+ * SYNTH_FIXED_POINT_PHASE for the given frames, and returns its phase.
+ */
+static float floatPhaseAfter(float increment, uint32_t frames) {
+
+	float phase = 0;
+
+	for(uint32_t n = 0; n < frames; n++) {
+		phase += increment;
+		if(phase >= kSynth_Table_Length) {
+			phase = phase - kSynth_Table_Length;
+		}
+	}
+
+	return phase;
+}
+
+int main(void) {
+
+	wavetableSynth *synth = &g_demoSynth;
+	int32_t out[kAudio_Block_Frames];
+
+	uint32_t blocks = kTest_Seconds * kAudio_Frame_Hz / kAudio_Block_Frames;
+	uint32_t frames = blocks * kAudio_Block_Frames;
+
+	double worstFixed = 0, worstFloat = 0, worstCents = 0;
+
+	initSynth(synth, kSynth_Num_Keys, kSynth_A3_Index, TONE_A3_HZ, 0);
+	for(uint32_t level = 0; level < kSynth_Mip_Levels; level++) {
+		silentTable.level[level] = silentLevel;
+	}
+	synth->wavetable = &silentTable;
+
+	for(uint32_t key = 0; key < kSynth_Num_Keys; key++) {
+
+		pressKey(synth, key, kSynth_Max_Velocity);
+		for(uint32_t b = 0; b < blocks; b++) {
+			playSynthBlock(synth, out, kAudio_Block_Frames);
+		}
+		releaseKey(synth, key);
+
+		/* The tuning the synth asked for, carried exactly */
+		double increment = synth->phaseIncrement[key];
+		double exact = fmod(increment * frames, kSynth_Table_Length);
+
+		/* The step is truncated to at most one LSB below the increment */
+		double fixedStep = synth->phaseStep[key] / PHASE_ONE;
+		double fixedError = phaseDistance(synth->phase[key] / PHASE_ONE, exact);
+		double floatError = phaseDistance(floatPhaseAfter(synth->phaseIncrement[key], frames), exact);
+		double cents = 1200.0 * log2(increment / fixedStep);
+
+		TEST_CHECK(fixedStep <= increment && increment - fixedStep <= 1.0 / PHASE_ONE,
+				"key %u: step %.9f for increment %.9f", key, fixedStep, increment);
+		TEST_CHECK(fixedError <= frames / PHASE_ONE,
+				"key %u: phase off by %.6f samples after %u frames", key, fixedError, frames);
+
+		if(fixedError > worstFixed) worstFixed = fixedError;
+		if(floatError > worstFloat) worstFloat = floatError;
+		if(cents > worstCents) worstCents = cents;
+	}
+
+	TEST_CHECK(worstFixed < worstFloat,
+			"fixed-point phase error %.6f is no better than float %.6f", worstFixed, worstFloat);
+
+	printf("after %u s: worst phase error %.6f samples fixed-point, %.6f float; worst tuning error %.6f cents\n",
+			kTest_Seconds, worstFixed, worstFloat, worstCents);
+
+	return TEST_RESULT("test_synth_phase");
+}
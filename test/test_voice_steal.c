@@ -0,0 +1,124 @@
+/*
+ * test_voice_steal.c
+ *
+ * Fills the voice pool and plays one note more, and checks the stolen
+ * voice fades out over kSynth_Steal_Fade_Frames rather than dropping
+ * out, using a constant wavetable so the output reads back as the
+ * summed gain of the sounding voices. Then checks a key caught fading
+ * comes back from where its fade had reached, and that a repeated note
+ * keeps its phase and only takes the new velocity.
+ */
+#define main speakEZ_main
+#include "speakEZ.c"
+#undef main
+
+#include "test_check.h"
+
+enum _test_voice_steal {
+	kTest_Table_Level	= 1000,
+	kTest_First_Key		= 48U
+};
+
+#define TEST_GAIN_TOLERANCE		1e-3	// of one voice at full velocity
+
+static int16_t constantLevel[kSynth_Table_Length];
+static wavetableMipmap constantTable;
+
+
+/*
+ * heardGain
+ *
+ * Reads frame n of out back as the summed gain of the voices sounding.
+ */
+static double heardGain(const int32_t *out, uint32_t n) {
+
+	return out[n] / (SYNTH_MIP_SCALE * kTest_Table_Level);
+}
+/*
+ * fillPool
+ *
+ * Presses SYNTH_MAX_VOICES keys up from kTest_First_Key at full
+ * velocity, oldest first, and plays a block so they are all sounding.
+ */
+static void fillPool(wavetableSynth *synth, int32_t *out) {
+
+	for(uint32_t v = 0; v < SYNTH_MAX_VOICES; v++) {
+		pressKey(synth, kTest_First_Key + v, kSynth_Max_Velocity);
+	}
+	playSynthBlock(synth, out, kAudio_Block_Frames);
+}
+
+int main(void) {
+
+	wavetableSynth *synth = &g_demoSynth;
+	int32_t out[kSynth_Steal_Fade_Frames];
+	uint32_t stolenKey = kTest_First_Key;
+	uint32_t newKey = kTest_First_Key + SYNTH_MAX_VOICES;
+
+	for(uint32_t n = 0; n < kSynth_Table_Length; n++) {
+		constantLevel[n] = kTest_Table_Level;
+	}
+	for(uint32_t level = 0; level < kSynth_Mip_Levels; level++) {
+		constantTable.level[level] = constantLevel;
+	}
+
+	/* The oldest voice is stolen, and ramps down beside the pool instead of cutting off */
+	initSynth(synth, kSynth_Num_Keys, kSynth_A3_Index, TONE_A3_HZ, kUSBMIDI_Channel_1);
+	synth->wavetable = &constantTable;
+	fillPool(synth, out);
+
+	pressKey(synth, newKey, kSynth_Max_Velocity);
+	TEST_CHECK(synth->numActive == SYNTH_MAX_VOICES && synth->velocity[stolenKey] == 0,
+			"steal: %u voices, stolen key velocity %u", synth->numActive, synth->velocity[stolenKey]);
+	TEST_CHECK(synth->numFading == 1 && synth->fadingKeys[0] == stolenKey, "steal: %u fading", synth->numFading);
+
+	/* Played in uneven runs, as the MIDI schedule would split the blocks */
+	for(uint32_t n = 0, run = 5; n < kSynth_Steal_Fade_Frames; n += run, run = kAudio_Block_Frames) {
+		if(run > kSynth_Steal_Fade_Frames - n) run = kSynth_Steal_Fade_Frames - n;
+		playSynthBlock(synth, out + n, run);
+	}
+
+	double worstError = 0;
+	for(uint32_t n = 0; n < kSynth_Steal_Fade_Frames; n++) {
+		double expected = SYNTH_MAX_VOICES + (double)(kSynth_Steal_Fade_Frames - n) / kSynth_Steal_Fade_Frames;
+		worstError = fmax(worstError, fabs(heardGain(out, n) - expected));
+	}
+	TEST_CHECK(worstError < TEST_GAIN_TOLERANCE, "steal: fade off its ramp by %f of a voice", worstError);
+	TEST_CHECK(synth->numFading == 0, "steal: %u still fading after the fade", synth->numFading);
+
+	playSynthBlock(synth, out, 1);
+	TEST_CHECK(fabs(heardGain(out, 0) - SYNTH_MAX_VOICES) < TEST_GAIN_TOLERANCE,
+			"steal: %f voices after the fade, expected %u", heardGain(out, 0), SYNTH_MAX_VOICES);
+
+	/* A key pressed again while fading leaves the fade and takes a voice */
+	initSynth(synth, kSynth_Num_Keys, kSynth_A3_Index, TONE_A3_HZ, kUSBMIDI_Channel_1);
+	synth->wavetable = &constantTable;
+	fillPool(synth, out);
+
+	pressKey(synth, newKey, kSynth_Max_Velocity);
+	playSynthBlock(synth, out, 10);
+	pressKey(synth, stolenKey, kSynth_Max_Velocity);
+
+	TEST_CHECK(synth->velocity[stolenKey] != 0, "refade: the faded key has no voice");
+	TEST_CHECK(synth->numFading == 1 && synth->fadingKeys[0] == kTest_First_Key + 1,
+			"refade: %u fading, first %u", synth->numFading, synth->fadingKeys[0]);
+
+	/* A repeated note keeps its phase, under every policy */
+	for(uint32_t policy = kSynth_Steal_Oldest; policy <= kSynth_Steal_Same_Note; policy++) {
+
+		initSynth(synth, kSynth_Num_Keys, kSynth_A3_Index, TONE_A3_HZ, kUSBMIDI_Channel_1);
+		synth->wavetable = &constantTable;
+		synth->voiceSteal = (voice_steal_t)policy;
+
+		pressKey(synth, kTest_First_Key, kSynth_Max_Velocity);
+		playSynthBlock(synth, out, 7);
+		synth_phase_t phase = synth->phase[kTest_First_Key];
+
+		pressKey(synth, kTest_First_Key, kSynth_Max_Velocity / 2);
+		TEST_CHECK(synth->phase[kTest_First_Key] == phase, "policy %u: the repeated note restarted its phase", policy);
+		TEST_CHECK(synth->velocity[kTest_First_Key] == kSynth_Max_Velocity / 2 && synth->numActive == 1,
+				"policy %u: velocity %u on %u voices", policy, synth->velocity[kTest_First_Key], synth->numActive);
+	}
+
+	return TEST_RESULT("test_voice_steal");
+}
@@ -283,6 +283,7 @@ static usb_status_t USB_HostCdcOpenDataInterface(usb_host_cdc_instance_struct_t
             pipeInit.numberPerUframe = (USB_SHORT_FROM_LITTLE_ENDIAN_ADDRESS(ep_desc->wMaxPacketSize) &
                                         USB_DESCRIPTOR_ENDPOINT_MAXPACKETSIZE_MULT_TRANSACTIONS_MASK);
             pipeInit.nakCount = USB_HOST_CONFIG_MAX_NAK;
+            pipeInit.noTimeout = 0;
 
             cdcInstance->bulkInPacketSize = pipeInit.maxPacketSize;
             status = USB_HostOpenPipe(cdcInstance->hostHandle, &cdcInstance->inPipe, &pipeInit);
@@ -308,6 +309,7 @@ static usb_status_t USB_HostCdcOpenDataInterface(usb_host_cdc_instance_struct_t
             pipeInit.numberPerUframe = (USB_SHORT_FROM_LITTLE_ENDIAN_ADDRESS(ep_desc->wMaxPacketSize) &
                                         USB_DESCRIPTOR_ENDPOINT_MAXPACKETSIZE_MULT_TRANSACTIONS_MASK);
             pipeInit.nakCount = USB_HOST_CONFIG_MAX_NAK;
+            pipeInit.noTimeout = 0;
 
             cdcInstance->bulkOutPacketSize = pipeInit.maxPacketSize;
             status = USB_HostOpenPipe(cdcInstance->hostHandle, &cdcInstance->outPipe, &pipeInit);
@@ -407,6 +409,7 @@ static usb_status_t USB_HostCdcOpenControlInterface(usb_host_cdc_instance_struct
             pipeInit.numberPerUframe = (USB_SHORT_FROM_LITTLE_ENDIAN_ADDRESS(ep_desc->wMaxPacketSize) &
                                         USB_DESCRIPTOR_ENDPOINT_MAXPACKETSIZE_MULT_TRANSACTIONS_MASK);
             pipeInit.nakCount = USB_HOST_CONFIG_MAX_NAK;
+            pipeInit.noTimeout = 0;
 
             cdcInstance->packetSize = pipeInit.maxPacketSize;
 
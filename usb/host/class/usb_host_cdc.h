@@ -212,8 +212,6 @@ typedef struct _usb_host_cdc_instance_struct
     usb_host_handle hostHandle;                             /*!< The handle of the USB host. */
     usb_device_handle deviceHandle;                         /*!< The handle of the USB device structure. */
 
-    usb_host_class_handle classHandle;						/*!< ADDED NEW!! class handle for the USB structure */
-    usb_host_configuration_handle configHandle;	 			/*!< ADDED NEW!! This instance's related configuration handle */
 
     usb_host_interface_handle controlInterfaceHandle;       /*!< The handle of the CDC device control interface. */
     usb_host_interface_handle dataInterfaceHandle;          /*!< The handle of the CDC device data interface. */
@@ -242,11 +240,6 @@ typedef struct _usb_host_cdc_instance_struct
     uint16_t packetSize;        /*!< CDC control pipe maximum packet size*/
     uint16_t bulkOutPacketSize; /*!< CDC bulk out maximum packet size*/
     uint16_t bulkInPacketSize;  /*!< CDC bulk in maximum packet size*/
-
-    uint8_t deviceState;		/*!< ADDED NEW!! audio device attach/detach status*/
-    uint8_t prevState;			/*!< ADDED NEW!! audio device attach/detach previous status*/
-    uint8_t runState;			/*!< ADDED NEW!! audio application run status*/
-    uint8_t runWaitState;		/*!< ADDED NEW!! audio application wait status, signals need to progress*/
 } usb_host_cdc_instance_struct_t;
 
 #ifdef __cplusplus
@@ -0,0 +1,794 @@
+/*
+ * Copyright 2020 Brady Etz, aka Wandering Sounds
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "usb_host_config.h"
+#if ((defined USB_HOST_CONFIG_MIDI) && (USB_HOST_CONFIG_MIDI))
+#include "usb_host.h"
+#include "usb_host_midi.h"
+#include "usb_host_devices.h"
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static usb_status_t USB_HostMidiRecvBuffer(usb_host_midi_instance_t *midiInstance, uint32_t buffer);
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/*!
+ * @brief put a packet on a ring.
+ *
+ * Producer side. The barrier keeps the packet ahead of the index.
+ *
+ * @param ring      the ring.
+ * @param packet    the packet.
+ * @param timestamp the packet's timestamp.
+ *
+ * @return 0 if the ring is full and the packet was dropped, or 1.
+ */
+static uint8_t USB_HostMidiRingPush(usb_host_midi_packet_ring_t *ring, uint32_t packet, uint32_t timestamp)
+{
+    uint32_t head = ring->head;
+    uint32_t depth = head - ring->tail;
+
+    if (depth >= ring->size)
+    {
+        ring->overflows = ring->overflows + 1U;
+        return 0U;
+    }
+
+    ring->packets[head & (ring->size - 1U)] = packet;
+    if (ring->timestamps != NULL)
+    {
+        ring->timestamps[head & (ring->size - 1U)] = timestamp;
+    }
+    __DMB();
+    ring->head = head + 1U;
+
+    if (depth + 1U > ring->highWater)
+    {
+        ring->highWater = depth + 1U;
+    }
+    return 1U;
+}
+
+/*!
+ * @brief put the event packets of a received buffer on a ring.
+ *
+ * Empty (all-zero) packets pad out short transfers on some devices and are skipped, as is any trailing partial
+ * packet.
+ *
+ * @param data          the received data.
+ * @param dataLength    the received length.
+ * @param ring          the ring.
+ *
+ * @return the number of packets put on the ring.
+ */
+static uint32_t USB_HostMidiParsePackets(uint8_t *data, uint32_t dataLength, usb_host_midi_packet_ring_t *ring)
+{
+    uint32_t count = 0U;
+    uint32_t packet;
+    uint32_t timestamp = (ring->clock != NULL) ? ring->clock() : 0U;
+
+    for (uint32_t offset = 0U; (offset + USB_HOST_MIDI_PACKET_SIZE) <= dataLength; offset += USB_HOST_MIDI_PACKET_SIZE)
+    {
+        packet = USB_LONG_FROM_LITTLE_ENDIAN_ADDRESS((&data[offset]));
+        if (packet == 0U)
+        {
+            continue;
+        }
+        count += USB_HostMidiRingPush(ring, packet, timestamp);
+    }
+    return count;
+}
+
+/*!
+ * @brief midi in pipe transfer callback.
+ *
+ * The received packets go on the ring, then the buffer goes straight back on the pipe, behind any other buffer
+ * that is already queued.
+ *
+ * @param param       callback parameter.
+ * @param transfer    callback transfer.
+ * @param status      transfer status.
+ */
+static void USB_HostMidiInPipeCallback(void *param, usb_host_transfer_t *transfer, usb_status_t status)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)param;
+    uint32_t buffer = (uint32_t)(transfer->transferBuffer - midiInstance->inBuffer[0]) / USB_HOST_MIDI_IN_BUFFER_SIZE;
+    uint32_t length = transfer->transferSofar;
+    uint32_t count = 0U;
+
+    USB_HostFreeTransfer(midiInstance->hostHandle, transfer);
+    midiInstance->inArmed &= (uint8_t)(~(1U << buffer));
+
+    if (status == kStatus_USB_Success)
+    {
+        if (midiInstance->inRing != NULL)
+        {
+            count = USB_HostMidiParsePackets(midiInstance->inBuffer[buffer], length, midiInstance->inRing);
+        }
+        status = USB_HostMidiRecvBuffer(midiInstance, buffer);
+    }
+
+    if (midiInstance->inCallbackFn != NULL)
+    {
+        /* callback to application, the callback function is initialized in USB_HostMidiStreamStart */
+        midiInstance->inCallbackFn(midiInstance->inCallbackParam, count, status);
+    }
+}
+
+/*!
+ * @brief midi out pipe transfer callback.
+ *
+ * @param param       callback parameter.
+ * @param transfer    callback transfer.
+ * @param status      transfer status.
+ */
+static void USB_HostMidiOutPipeCallback(void *param, usb_host_transfer_t *transfer, usb_status_t status)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)param;
+
+    if (midiInstance->outCallbackFn != NULL)
+    {
+        /* callback to application, the callback function is initialized in USB_HostMidiSend */
+        midiInstance->outCallbackFn(midiInstance->outCallbackParam, transfer->transferBuffer, transfer->transferSofar,
+                                    status);
+    }
+    USB_HostFreeTransfer(midiInstance->hostHandle, transfer);
+}
+
+/*!
+ * @brief queue one receive buffer on the midi in pipe.
+ *
+ * @param midiInstance    midi instance pointer.
+ * @param buffer          receive buffer index.
+ *
+ * @return kStatus_USB_Success or error codes.
+ */
+static usb_status_t USB_HostMidiRecvBuffer(usb_host_midi_instance_t *midiInstance, uint32_t buffer)
+{
+    usb_host_transfer_t *transfer;
+    uint32_t length = midiInstance->inPacketSize;
+
+    if ((length == 0U) || (length > USB_HOST_MIDI_IN_BUFFER_SIZE))
+    {
+        length = USB_HOST_MIDI_IN_BUFFER_SIZE;
+    }
+
+    if (USB_HostMallocTransfer(midiInstance->hostHandle, &transfer) != kStatus_USB_Success)
+    {
+#ifdef HOST_ECHO
+        usb_echo("error to get transfer\r\n");
+#endif
+        return kStatus_USB_Error;
+    }
+    transfer->transferBuffer = midiInstance->inBuffer[buffer];
+    transfer->transferLength = length;
+    transfer->callbackFn = USB_HostMidiInPipeCallback;
+    transfer->callbackParam = midiInstance;
+
+    if (USB_HostRecv(midiInstance->hostHandle, midiInstance->inPipe, transfer) != kStatus_USB_Success)
+    {
+#ifdef HOST_ECHO
+        usb_echo("failed to USB_HostRecv\r\n");
+#endif
+        USB_HostFreeTransfer(midiInstance->hostHandle, transfer);
+        return kStatus_USB_Error;
+    }
+    midiInstance->inArmed |= (uint8_t)(1U << buffer);
+
+    return kStatus_USB_Success;
+}
+
+/*!
+ * @brief count the cables on a midi endpoint.
+ *
+ * Walks the descriptors following the endpoint descriptor for its MS_GENERAL descriptor.
+ *
+ * @param ep    endpoint information.
+ *
+ * @return the number of embedded jacks, or 0 if the endpoint has no MS_GENERAL descriptor.
+ */
+static uint8_t USB_HostMidiEndpointCables(usb_host_ep_t *ep)
+{
+    usb_host_midi_ms_endpoint_desc_t *msDesc;
+    uint32_t offset = 0U;
+
+    while ((offset + 4U) <= ep->epExtensionLength)
+    {
+        msDesc = (usb_host_midi_ms_endpoint_desc_t *)(&ep->epExtension[offset]);
+        if (msDesc->bLength < 4U)
+        {
+            break;
+        }
+        if ((msDesc->bDescriptorType == USB_HOST_MIDI_DESCRIPTOR_TYPE_CS_ENDPOINT) &&
+            (msDesc->bDescriptorSubtype == USB_HOST_MIDI_MS_GENERAL))
+        {
+            return msDesc->bNumEmbMIDIJack;
+        }
+        offset += msDesc->bLength;
+    }
+    return 0U;
+}
+
+/*!
+ * @brief midi close the streaming pipes.
+ *
+ * @param midiInstance    midi instance pointer.
+ */
+static void USB_HostMidiClosePipes(usb_host_midi_instance_t *midiInstance)
+{
+    usb_status_t status;
+
+    if (midiInstance->inPipe != NULL)
+    {
+        status = USB_HostCancelTransfer(midiInstance->hostHandle, midiInstance->inPipe, NULL);
+        status = USB_HostClosePipe(midiInstance->hostHandle, midiInstance->inPipe);
+
+        if (status != kStatus_USB_Success)
+        {
+#ifdef HOST_ECHO
+            usb_echo("error when close pipe\r\n");
+#endif
+        }
+        midiInstance->inPipe = NULL;
+    }
+    if (midiInstance->outPipe != NULL)
+    {
+        status = USB_HostCancelTransfer(midiInstance->hostHandle, midiInstance->outPipe, NULL);
+        status = USB_HostClosePipe(midiInstance->hostHandle, midiInstance->outPipe);
+
+        if (status != kStatus_USB_Success)
+        {
+#ifdef HOST_ECHO
+            usb_echo("error when close pipe\r\n");
+#endif
+        }
+        midiInstance->outPipe = NULL;
+    }
+    midiInstance->inArmed = 0U;
+}
+
+/*!
+ * @brief midi open streaming interface.
+ *
+ * Reads the MIDISTREAMING header for the class release, then opens a pipe for the first bulk or interrupt endpoint
+ * in each direction. Endpoints with an MS_GENERAL descriptor are preferred, as that is what marks them as carrying
+ * MIDI; one without is only used when there is no other.
+ *
+ * @param midiInstance    midi instance pointer.
+ *
+ * @return kStatus_USB_Success or error codes.
+ */
+static usb_status_t USB_HostMidiOpenStreamingInterface(usb_host_midi_instance_t *midiInstance)
+{
+    usb_status_t status;
+    uint8_t ep_index = 0;
+    uint8_t cables;
+    uint8_t pipeType;
+    uint8_t direction;
+    usb_host_pipe_init_t pipeInit;
+    usb_descriptor_endpoint_t *ep_desc = NULL;
+    usb_host_interface_t *interfaceHandle;
+    usb_host_midi_ms_header_desc_t *headerDesc;
+    usb_host_ep_t *inEp = NULL;
+    usb_host_ep_t *outEp = NULL;
+    uint8_t inCables = 0U;
+    uint8_t outCables = 0U;
+    uint32_t offset = 0U;
+
+    USB_HostMidiClosePipes(midiInstance);
+
+    status = USB_HostOpenDeviceInterface(midiInstance->deviceHandle, midiInstance->streamingInterfaceHandle);
+    if (status != kStatus_USB_Success)
+    {
+        return status;
+    }
+    interfaceHandle = (usb_host_interface_t *)midiInstance->streamingInterfaceHandle;
+
+    /* class-specific interface descriptors */
+    midiInstance->msVersion = 0U;
+    while ((offset + sizeof(usb_host_midi_ms_header_desc_t)) <= interfaceHandle->interfaceExtensionLength)
+    {
+        headerDesc = (usb_host_midi_ms_header_desc_t *)(&interfaceHandle->interfaceExtension[offset]);
+        if (headerDesc->bLength < 3U)
+        {
+            break;
+        }
+        if ((headerDesc->bDescriptorType == USB_HOST_MIDI_DESCRIPTOR_TYPE_CS_INTERFACE) &&
+            (headerDesc->bDescriptorSubtype == USB_HOST_MIDI_MS_HEADER))
+        {
+            midiInstance->msVersion = (uint16_t)USB_SHORT_FROM_LITTLE_ENDIAN_ADDRESS(headerDesc->bcdMSC);
+            break;
+        }
+        offset += headerDesc->bLength;
+    }
+
+    /* pick the endpoints */
+    for (ep_index = 0; ep_index < interfaceHandle->epCount; ++ep_index)
+    {
+        ep_desc = interfaceHandle->epList[ep_index].epDesc;
+        pipeType = ep_desc->bmAttributes & USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_TYPE_MASK;
+        if ((pipeType != USB_ENDPOINT_BULK) && (pipeType != USB_ENDPOINT_INTERRUPT))
+        {
+            continue;
+        }
+
+        cables = USB_HostMidiEndpointCables(&interfaceHandle->epList[ep_index]);
+        if ((ep_desc->bEndpointAddress & USB_DESCRIPTOR_ENDPOINT_ADDRESS_DIRECTION_MASK) ==
+            USB_DESCRIPTOR_ENDPOINT_ADDRESS_DIRECTION_IN)
+        {
+            if ((inEp == NULL) || ((inCables == 0U) && (cables != 0U)))
+            {
+                inEp = &interfaceHandle->epList[ep_index];
+                inCables = cables;
+            }
+        }
+        else
+        {
+            if ((outEp == NULL) || ((outCables == 0U) && (cables != 0U)))
+            {
+                outEp = &interfaceHandle->epList[ep_index];
+                outCables = cables;
+            }
+        }
+    }
+
+    if ((inEp == NULL) && (outEp == NULL))
+    {
+#ifdef HOST_ECHO
+        usb_echo("no midi endpoint\r\n");
+#endif
+        return kStatus_USB_Error;
+    }
+
+    /* open the pipes */
+    for (direction = USB_OUT; direction <= USB_IN; ++direction)
+    {
+        usb_host_ep_t *ep = (direction == USB_IN) ? inEp : outEp;
+
+        if (ep == NULL)
+        {
+            continue;
+        }
+        ep_desc = ep->epDesc;
+
+        pipeInit.devInstance = midiInstance->deviceHandle;
+        pipeInit.pipeType = ep_desc->bmAttributes & USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_TYPE_MASK;
+        pipeInit.direction = direction;
+        pipeInit.endpointAddress = (ep_desc->bEndpointAddress & USB_DESCRIPTOR_ENDPOINT_ADDRESS_NUMBER_MASK);
+        pipeInit.interval = ep_desc->bInterval;
+        pipeInit.maxPacketSize = (uint16_t)(USB_SHORT_FROM_LITTLE_ENDIAN_ADDRESS(ep_desc->wMaxPacketSize) &
+                                            USB_DESCRIPTOR_ENDPOINT_MAXPACKETSIZE_SIZE_MASK);
+        pipeInit.numberPerUframe = (USB_SHORT_FROM_LITTLE_ENDIAN_ADDRESS(ep_desc->wMaxPacketSize) &
+                                    USB_DESCRIPTOR_ENDPOINT_MAXPACKETSIZE_MULT_TRANSACTIONS_MASK);
+        pipeInit.nakCount = USB_HOST_CONFIG_MAX_NAK;
+        /* a keyboard NAKs the IN pipe for as long as nothing is played */
+        pipeInit.noTimeout = (direction == USB_IN) ? 1U : 0U;
+
+        if (direction == USB_IN)
+        {
+            midiInstance->inPacketSize = pipeInit.maxPacketSize;
+            midiInstance->inCables = (inCables != 0U) ? inCables : 1U;
+            status = USB_HostOpenPipe(midiInstance->hostHandle, &midiInstance->inPipe, &pipeInit);
+        }
+        else
+        {
+            midiInstance->outPacketSize = pipeInit.maxPacketSize;
+            midiInstance->outCables = (outCables != 0U) ? outCables : 1U;
+            status = USB_HostOpenPipe(midiInstance->hostHandle, &midiInstance->outPipe, &pipeInit);
+        }
+
+        if (status != kStatus_USB_Success)
+        {
+#ifdef HOST_ECHO
+            usb_echo("USB_HostMidiSetInterface fail to open pipe\r\n");
+#endif
+            return kStatus_USB_Error;
+        }
+    }
+
+    return kStatus_USB_Success;
+}
+
+/*!
+ * @brief midi set interface callback, open pipes.
+ *
+ * @param param       callback parameter.
+ * @param transfer    callback transfer.
+ * @param status      transfer status.
+ */
+static void USB_HostMidiSetInterfaceCallback(void *param, usb_host_transfer_t *transfer, usb_status_t status)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)param;
+
+    midiInstance->controlTransfer = NULL;
+    if (status == kStatus_USB_Success)
+    {
+        status = USB_HostMidiOpenStreamingInterface(midiInstance);
+    }
+
+    if (midiInstance->controlCallbackFn != NULL)
+    {
+        /* callback to application, the callback function is initialized in USB_HostMidiSetInterface */
+        midiInstance->controlCallbackFn(midiInstance->controlCallbackParam, NULL, 0, status);
+    }
+    USB_HostFreeTransfer(midiInstance->hostHandle, transfer);
+}
+
+/*!
+ * @brief initialize the midi instance.
+ *
+ * This function allocate the resource for midi instance.
+ *
+ * @param deviceHandle       the device handle.
+ * @param classHandle return class handle.
+ *
+ * @retval kStatus_USB_Success        The device is initialized successfully.
+ * @retval kStatus_USB_AllocFail      Allocate memory fail.
+ */
+usb_status_t USB_HostMidiInit(usb_device_handle deviceHandle, usb_host_class_handle *classHandle)
+{
+    usb_host_midi_instance_t *midiInstance =
+        (usb_host_midi_instance_t *)USB_OsaMemoryAllocate(sizeof(usb_host_midi_instance_t));
+    uint32_t info_value;
+
+    if (midiInstance == NULL)
+    {
+        return kStatus_USB_AllocFail;
+    }
+
+    midiInstance->deviceHandle = deviceHandle;
+    midiInstance->controlInterfaceHandle = NULL;
+    midiInstance->streamingInterfaceHandle = NULL;
+    USB_HostHelperGetPeripheralInformation(deviceHandle, kUSB_HostGetHostHandle, &info_value);
+    midiInstance->hostHandle = (usb_host_handle)info_value;
+    USB_HostHelperGetPeripheralInformation(deviceHandle, kUSB_HostGetDeviceControlPipe, &info_value);
+    midiInstance->controlPipe = (usb_host_pipe_handle)info_value;
+
+    *classHandle = midiInstance;
+    return kStatus_USB_Success;
+}
+
+/*!
+ * @brief set the midi interfaces.
+ *
+ * This function binds the interfaces with the midi instance and opens the midi pipes.
+ *
+ * @param classHandle              the class handle.
+ * @param controlInterfaceHandle   the audio control interface handle, may be NULL.
+ * @param streamingInterfaceHandle the midi streaming interface handle.
+ * @param alternateSetting         the alternate setting value.
+ * @param callbackFn               this callback is called after this function completes.
+ * @param callbackParam            the first parameter in the callback function.
+ *
+ * @return An error code or kStatus_USB_Success.
+ */
+usb_status_t USB_HostMidiSetInterface(usb_host_class_handle classHandle,
+                                      usb_host_interface_handle controlInterfaceHandle,
+                                      usb_host_interface_handle streamingInterfaceHandle,
+                                      uint8_t alternateSetting,
+                                      transfer_callback_t callbackFn,
+                                      void *callbackParam)
+{
+    usb_status_t status = kStatus_USB_Success;
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)classHandle;
+    usb_host_transfer_t *transfer;
+
+    if ((classHandle == NULL) || (streamingInterfaceHandle == NULL))
+    {
+        return kStatus_USB_InvalidHandle;
+    }
+
+    /* the audio control interface carries no midi endpoints, it is only claimed */
+    if ((controlInterfaceHandle != NULL) && (controlInterfaceHandle != midiInstance->controlInterfaceHandle))
+    {
+        status = USB_HostOpenDeviceInterface(midiInstance->deviceHandle, controlInterfaceHandle);
+        if (status != kStatus_USB_Success)
+        {
+            return status;
+        }
+    }
+    midiInstance->controlInterfaceHandle = controlInterfaceHandle;
+    midiInstance->streamingInterfaceHandle = streamingInterfaceHandle;
+
+    if (alternateSetting == 0U)
+    {
+        status = USB_HostMidiOpenStreamingInterface(midiInstance);
+        if (callbackFn != NULL)
+        {
+            callbackFn(callbackParam, NULL, 0, status);
+        }
+    }
+    else
+    {
+        if (USB_HostMallocTransfer(midiInstance->hostHandle, &transfer) != kStatus_USB_Success)
+        {
+#ifdef HOST_ECHO
+            usb_echo("error to get transfer\r\n");
+#endif
+            return kStatus_USB_Error;
+        }
+        midiInstance->controlCallbackFn = callbackFn;
+        midiInstance->controlCallbackParam = callbackParam;
+        /* initialize transfer */
+        transfer->callbackFn = USB_HostMidiSetInterfaceCallback;
+        transfer->callbackParam = midiInstance;
+        transfer->setupPacket->bRequest = USB_REQUEST_STANDARD_SET_INTERFACE;
+        transfer->setupPacket->bmRequestType = USB_REQUEST_TYPE_RECIPIENT_INTERFACE;
+        transfer->setupPacket->wIndex = USB_SHORT_TO_LITTLE_ENDIAN(
+            ((usb_host_interface_t *)streamingInterfaceHandle)->interfaceDesc->bInterfaceNumber);
+        transfer->setupPacket->wValue = USB_SHORT_TO_LITTLE_ENDIAN(alternateSetting);
+        transfer->setupPacket->wLength = 0;
+        transfer->transferBuffer = NULL;
+        transfer->transferLength = 0;
+        status = USB_HostSendSetup(midiInstance->hostHandle, midiInstance->controlPipe, transfer);
+
+        if (status == kStatus_USB_Success)
+        {
+            midiInstance->controlTransfer = transfer;
+        }
+        else
+        {
+            USB_HostFreeTransfer(midiInstance->hostHandle, transfer);
+        }
+    }
+
+    return status;
+}
+
+/*!
+ * @brief de-initialize the midi instance.
+ *
+ * This function release the resource for midi instance. The stream callback is not called for the transfers it
+ * cancels.
+ *
+ * @param deviceHandle   the device handle.
+ * @param classHandle    the class handle.
+ *
+ * @retval kStatus_USB_Success        The device is de-initialized successfully.
+ */
+usb_status_t USB_HostMidiDeinit(usb_device_handle deviceHandle, usb_host_class_handle classHandle)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)classHandle;
+
+    if (deviceHandle == NULL)
+    {
+        return kStatus_USB_InvalidHandle;
+    }
+
+    if (classHandle != NULL)
+    {
+        midiInstance->inCallbackFn = NULL;
+        midiInstance->outCallbackFn = NULL;
+        USB_HostMidiClosePipes(midiInstance);
+
+        if ((midiInstance->controlPipe != NULL) && (midiInstance->controlTransfer != NULL))
+        {
+            (void)USB_HostCancelTransfer(midiInstance->hostHandle, midiInstance->controlPipe,
+                                         midiInstance->controlTransfer);
+        }
+        if (midiInstance->controlInterfaceHandle != NULL)
+        {
+            USB_HostCloseDeviceInterface(deviceHandle, midiInstance->controlInterfaceHandle);
+        }
+        USB_HostCloseDeviceInterface(deviceHandle, midiInstance->streamingInterfaceHandle);
+
+        USB_OsaMemoryFree(midiInstance);
+    }
+    else
+    {
+        USB_HostCloseDeviceInterface(deviceHandle, NULL);
+    }
+
+    return kStatus_USB_Success;
+}
+
+/*!
+ * @brief start or top up the receive stream.
+ *
+ * @param classHandle    the class handle.
+ * @param ring           ring the received packets go on.
+ * @param callbackFn     this callback is called after each receive transfer completes.
+ * @param callbackParam  the first parameter in the callback function.
+ *
+ * @return An error code or kStatus_USB_Success.
+ */
+usb_status_t USB_HostMidiStreamStart(usb_host_class_handle classHandle,
+                                     usb_host_midi_packet_ring_t *ring,
+                                     usb_host_midi_stream_callback_t callbackFn,
+                                     void *callbackParam)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)classHandle;
+    usb_status_t status = kStatus_USB_Success;
+
+    if (classHandle == NULL)
+    {
+        return kStatus_USB_InvalidHandle;
+    }
+
+    if (midiInstance->inPipe == NULL)
+    {
+        return kStatus_USB_Error;
+    }
+
+    midiInstance->inRing = ring;
+    midiInstance->inCallbackFn = callbackFn;
+    midiInstance->inCallbackParam = callbackParam;
+
+    for (uint32_t buffer = 0U; buffer < USB_HOST_MIDI_IN_TRANSFERS; ++buffer)
+    {
+        if (midiInstance->inArmed & (1U << buffer))
+        {
+            continue;
+        }
+        status = USB_HostMidiRecvBuffer(midiInstance, buffer);
+        if (status != kStatus_USB_Success)
+        {
+            break;
+        }
+    }
+
+    return status;
+}
+
+/*!
+ * @brief stop the receive stream.
+ *
+ * @param classHandle    the class handle.
+ *
+ * @return An error code or kStatus_USB_Success.
+ */
+usb_status_t USB_HostMidiStreamStop(usb_host_class_handle classHandle)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)classHandle;
+
+    if (classHandle == NULL)
+    {
+        return kStatus_USB_InvalidHandle;
+    }
+
+    if (midiInstance->inPipe != NULL)
+    {
+        (void)USB_HostCancelTransfer(midiInstance->hostHandle, midiInstance->inPipe, NULL);
+    }
+    return kStatus_USB_Success;
+}
+
+/*!
+ * @brief send event packets.
+ *
+ * @param classHandle    the class handle.
+ * @param buffer         the buffer pointer.
+ * @param bufferLength   the buffer length.
+ * @param callbackFn     this callback is called after this function completes.
+ * @param callbackParam  the first parameter in the callback function.
+ *
+ * @return An error code or kStatus_USB_Success.
+ */
+usb_status_t USB_HostMidiSend(usb_host_class_handle classHandle,
+                              uint8_t *buffer,
+                              uint32_t bufferLength,
+                              transfer_callback_t callbackFn,
+                              void *callbackParam)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)classHandle;
+    usb_host_transfer_t *transfer;
+
+    if (classHandle == NULL)
+    {
+        return kStatus_USB_InvalidHandle;
+    }
+
+    if (midiInstance->outPipe == NULL)
+    {
+        return kStatus_USB_Error;
+    }
+
+    if (USB_HostMallocTransfer(midiInstance->hostHandle, &transfer) != kStatus_USB_Success)
+    {
+#ifdef HOST_ECHO
+        usb_echo("error to get transfer\r\n");
+#endif
+        return kStatus_USB_Error;
+    }
+    midiInstance->outCallbackFn = callbackFn;
+    midiInstance->outCallbackParam = callbackParam;
+    transfer->transferBuffer = buffer;
+    transfer->transferLength = bufferLength;
+    transfer->callbackFn = USB_HostMidiOutPipeCallback;
+    transfer->callbackParam = midiInstance;
+
+    if (USB_HostSend(midiInstance->hostHandle, midiInstance->outPipe, transfer) != kStatus_USB_Success)
+    {
+#ifdef HOST_ECHO
+        usb_echo("failed to USB_HostSend\r\n");
+#endif
+        USB_HostFreeTransfer(midiInstance->hostHandle, transfer);
+        return kStatus_USB_Error;
+    }
+    return kStatus_USB_Success;
+}
+
+uint16_t USB_HostMidiGetPacketsize(usb_host_class_handle classHandle, uint8_t direction)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)classHandle;
+
+    if (classHandle == NULL)
+    {
+        return 0U;
+    }
+
+    if (direction == USB_IN)
+    {
+        return (midiInstance->inPipe != NULL) ? midiInstance->inPacketSize : 0U;
+    }
+    return (midiInstance->outPipe != NULL) ? midiInstance->outPacketSize : 0U;
+}
+
+uint8_t USB_HostMidiGetCableCount(usb_host_class_handle classHandle, uint8_t direction)
+{
+    usb_host_midi_instance_t *midiInstance = (usb_host_midi_instance_t *)classHandle;
+
+    if (classHandle == NULL)
+    {
+        return 0U;
+    }
+
+    if (direction == USB_IN)
+    {
+        return (midiInstance->inPipe != NULL) ? midiInstance->inCables : 0U;
+    }
+    return (midiInstance->outPipe != NULL) ? midiInstance->outCables : 0U;
+}
+
+void USB_HostMidiRingInit(usb_host_midi_packet_ring_t *ring,
+                          uint32_t *packets,
+                          uint32_t *timestamps,
+                          uint32_t size,
+                          usb_host_midi_clock_t clock)
+{
+    ring->packets = packets;
+    ring->timestamps = timestamps;
+    ring->clock = clock;
+    ring->size = size;
+    ring->head = 0U;
+    ring->tail = 0U;
+    ring->overflows = 0U;
+    ring->highWater = 0U;
+}
+
+uint8_t USB_HostMidiRingPop(usb_host_midi_packet_ring_t *ring, uint32_t *packet, uint32_t *timestamp)
+{
+    uint32_t tail = ring->tail;
+
+    if (ring->head == tail)
+    {
+        return 0U;
+    }
+    __DMB(); /* don't read the packet from before the index was published */
+
+    *packet = ring->packets[tail & (ring->size - 1U)];
+    if (timestamp != NULL)
+    {
+        *timestamp = (ring->timestamps != NULL) ? ring->timestamps[tail & (ring->size - 1U)] : 0U;
+    }
+    __DMB();
+    ring->tail = tail + 1U;
+
+    return 1U;
+}
+
+uint32_t USB_HostMidiRingDepth(const usb_host_midi_packet_ring_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+#endif /* USB_HOST_CONFIG_MIDI */
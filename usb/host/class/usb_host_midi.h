@@ -0,0 +1,326 @@
+/*
+ * Copyright 2020 Brady Etz, aka Wandering Sounds
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef __USB_HOST_MIDI_H__
+#define __USB_HOST_MIDI_H__
+
+/*!
+ * @addtogroup usb_host_midi_drv
+ * @{
+ */
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+/*! @brief MIDI interface class code, MIDI is a subclass of AUDIO */
+#define USB_HOST_MIDI_CLASS_CODE (0x01U)
+/*! @brief AUDIOCONTROL interface subclass code */
+#define USB_HOST_MIDI_SUBCLASS_CODE_AUDIOCONTROL (0x01U)
+/*! @brief MIDISTREAMING interface subclass code */
+#define USB_HOST_MIDI_SUBCLASS_CODE_MIDISTREAMING (0x03U)
+
+/*! @brief class-specific descriptor types */
+#define USB_HOST_MIDI_DESCRIPTOR_TYPE_CS_INTERFACE (0x24U)
+#define USB_HOST_MIDI_DESCRIPTOR_TYPE_CS_ENDPOINT (0x25U)
+
+/*! @brief MIDISTREAMING class-specific interface descriptor subtypes */
+#define USB_HOST_MIDI_MS_HEADER (0x01U)
+#define USB_HOST_MIDI_MS_MIDI_IN_JACK (0x02U)
+#define USB_HOST_MIDI_MS_MIDI_OUT_JACK (0x03U)
+#define USB_HOST_MIDI_MS_ELEMENT (0x04U)
+
+/*! @brief MIDISTREAMING class-specific endpoint descriptor subtype */
+#define USB_HOST_MIDI_MS_GENERAL (0x01U)
+
+/*! @brief receive transfers kept queued on the IN pipe while streaming */
+#define USB_HOST_MIDI_IN_TRANSFERS (2U)
+/*! @brief size of each receive buffer, one full-speed bulk packet or 16 event packets */
+#define USB_HOST_MIDI_IN_BUFFER_SIZE (64U)
+
+/*! @brief size of a USB-MIDI event packet */
+#define USB_HOST_MIDI_PACKET_SIZE (4U)
+/*! @brief cable number of an event packet read from a ring */
+#define USB_HOST_MIDI_PACKET_CABLE(packet) (((packet) >> 4U) & 0x0FU)
+/*! @brief code index number of an event packet read from a ring */
+#define USB_HOST_MIDI_PACKET_CIN(packet) ((packet)&0x0FU)
+
+/*! @brief MIDISTREAMING class-specific interface header descriptor */
+typedef struct _usb_host_midi_ms_header_desc
+{
+    uint8_t bLength;            /*!< Size of this descriptor, 0x07*/
+    uint8_t bDescriptorType;    /*!< CS_INTERFACE*/
+    uint8_t bDescriptorSubtype; /*!< MS_HEADER*/
+    uint8_t bcdMSC[2];          /*!< MIDISTREAMING subclass release number*/
+    uint8_t wTotalLength[2];    /*!< Total size of the class-specific descriptors*/
+} usb_host_midi_ms_header_desc_t;
+
+/*! @brief MIDISTREAMING class-specific endpoint descriptor */
+typedef struct _usb_host_midi_ms_endpoint_desc
+{
+    uint8_t bLength;            /*!< Size of this descriptor, 0x04 + bNumEmbMIDIJack*/
+    uint8_t bDescriptorType;    /*!< CS_ENDPOINT*/
+    uint8_t bDescriptorSubtype; /*!< MS_GENERAL*/
+    uint8_t bNumEmbMIDIJack;    /*!< Number of embedded jacks, one per cable*/
+    uint8_t baAssocJackID[1];   /*!< IDs of the embedded jacks*/
+} usb_host_midi_ms_endpoint_desc_t;
+
+/*!
+ * @brief Clock function typedef, used to timestamp received packets.
+ *
+ * @return The current time, in whatever unit the application schedules in.
+ */
+typedef uint32_t (*usb_host_midi_clock_t)(void);
+
+/*!
+ * @brief Ring of received event packets.
+ *
+ * The storage is supplied by the caller, see USB_HostMidiRingInit. Packets are kept as they arrive on the wire,
+ * read little-endian, so the cable number and code index number are the low byte. There is one producer (the
+ * receive pipe callback) and one consumer (the application), and each index is only written by its own side.
+ * When the ring is full, new packets are dropped and counted.
+ *
+ * If the caller supplies timestamp storage and a clock, the clock is read once per received transfer, when the host
+ * task runs the transfer's completion, and every packet of that transfer carries the reading. The host task may run
+ * well after the data arrived, so to stamp arrival the clock should return a time latched in the controller's
+ * interrupt.
+ */
+typedef struct _usb_host_midi_packet_ring
+{
+    uint32_t *packets;           /*!< Caller's packet storage*/
+    uint32_t *timestamps;        /*!< Caller's timestamp storage, one per packet, or NULL*/
+    usb_host_midi_clock_t clock; /*!< Clock the timestamps are read from, or NULL*/
+    uint32_t size;               /*!< Number of packets in the storage, a power of two*/
+    volatile uint32_t head;      /*!< Written only by the producer*/
+    volatile uint32_t tail;      /*!< Written only by the consumer*/
+    volatile uint32_t overflows; /*!< Packets dropped on a full ring*/
+    volatile uint32_t highWater; /*!< Deepest the ring has been*/
+} usb_host_midi_packet_ring_t;
+
+/*!
+ * @brief Stream callback function typedef.
+ *
+ * Called after each receive transfer completes. On success, the transfer's packets are already on the ring and the
+ * buffer has been queued again. On any other status the buffer is idle, and USB_HostMidiStreamStart queues it again.
+ *
+ * @param param       The parameter passed to USB_HostMidiStreamStart.
+ * @param packetCount The number of packets put on the ring.
+ * @param status      Transfer status, or the status of queueing the buffer again.
+ */
+typedef void (*usb_host_midi_stream_callback_t)(void *param, uint32_t packetCount, usb_status_t status);
+
+/*! @brief MIDI instance structure */
+typedef struct _usb_host_midi_instance
+{
+    uint8_t inBuffer[USB_HOST_MIDI_IN_TRANSFERS][USB_HOST_MIDI_IN_BUFFER_SIZE]; /*!< Receive buffers*/
+    usb_host_handle hostHandle;                              /*!< The handle of the USB host*/
+    usb_device_handle deviceHandle;                          /*!< The handle of the USB device structure*/
+    usb_host_interface_handle controlInterfaceHandle;        /*!< AUDIOCONTROL interface, may be NULL*/
+    usb_host_interface_handle streamingInterfaceHandle;      /*!< MIDISTREAMING interface*/
+    usb_host_pipe_handle controlPipe;                        /*!< Control pipe*/
+    usb_host_pipe_handle inPipe;                             /*!< MIDI IN pipe, bulk or interrupt*/
+    usb_host_pipe_handle outPipe;                            /*!< MIDI OUT pipe, bulk or interrupt*/
+    usb_host_transfer_t *controlTransfer;                    /*!< Ongoing control transfer*/
+    transfer_callback_t controlCallbackFn;                   /*!< Set interface callback function pointer*/
+    void *controlCallbackParam;                              /*!< Set interface callback parameter*/
+    transfer_callback_t outCallbackFn;                       /*!< Send callback function pointer*/
+    void *outCallbackParam;                                  /*!< Send callback parameter*/
+    usb_host_midi_packet_ring_t *inRing;                     /*!< Ring the received packets go on*/
+    usb_host_midi_stream_callback_t inCallbackFn;            /*!< Stream callback function pointer*/
+    void *inCallbackParam;                                   /*!< Stream callback parameter*/
+    uint16_t msVersion;                                      /*!< MIDISTREAMING release, bcdMSC*/
+    uint16_t inPacketSize;                                   /*!< MIDI IN maximum packet size*/
+    uint16_t outPacketSize;                                  /*!< MIDI OUT maximum packet size*/
+    uint8_t inCables;                                        /*!< Embedded jacks on the IN endpoint*/
+    uint8_t outCables;                                       /*!< Embedded jacks on the OUT endpoint*/
+    uint8_t inArmed;                                         /*!< One bit per receive buffer queued on the IN pipe*/
+} usb_host_midi_instance_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*******************************************************************************
+ * API
+ ******************************************************************************/
+
+/*!
+ * @name USB host MIDI class APIs
+ * @{
+ */
+
+/*!
+ * @brief Initializes the MIDI instance.
+ *
+ * This function allocates the resource for the MIDI instance.
+ *
+ * @param[in] deviceHandle  The device handle.
+ * @param[out] classHandle  Return class handle.
+ *
+ * @retval kStatus_USB_Success        The device is initialized successfully.
+ * @retval kStatus_USB_AllocFail      Allocate memory fail.
+ */
+extern usb_status_t USB_HostMidiInit(usb_device_handle deviceHandle, usb_host_class_handle *classHandle);
+
+/*!
+ * @brief Sets the MIDI interfaces.
+ *
+ * This function binds the interfaces with the MIDI instance, reads the MIDISTREAMING class-specific descriptors and
+ * opens the MIDI IN and OUT pipes they describe. The callback is called when the pipes are open.
+ *
+ * @param[in] classHandle              The class handle.
+ * @param[in] controlInterfaceHandle   The AUDIOCONTROL interface handle, may be NULL.
+ * @param[in] streamingInterfaceHandle The MIDISTREAMING interface handle.
+ * @param[in] alternateSetting         The alternate setting value of the MIDISTREAMING interface.
+ * @param[in] callbackFn               This callback is called after this function completes.
+ * @param[in] callbackParam            The first parameter in the callback function.
+ *
+ * @retval kStatus_USB_Success        The device is initialized successfully.
+ * @retval kStatus_USB_InvalidHandle  The classHandle is NULL pointer.
+ * @retval kStatus_USB_Error          Send transfer fail. See the USB_HostSendSetup.
+ * @retval kStatus_USB_Error          Callback return status, no MIDI endpoint or open pipe fail.
+ */
+extern usb_status_t USB_HostMidiSetInterface(usb_host_class_handle classHandle,
+                                             usb_host_interface_handle controlInterfaceHandle,
+                                             usb_host_interface_handle streamingInterfaceHandle,
+                                             uint8_t alternateSetting,
+                                             transfer_callback_t callbackFn,
+                                             void *callbackParam);
+
+/*!
+ * @brief Deinitializes the MIDI instance.
+ *
+ * This function cancels the transfers, closes the pipes and frees the MIDI instance.
+ *
+ * @param[in] deviceHandle The device handle.
+ * @param[in] classHandle  The class handle.
+ *
+ * @retval kStatus_USB_Success        The device is deinitialized successfully.
+ */
+extern usb_status_t USB_HostMidiDeinit(usb_device_handle deviceHandle, usb_host_class_handle classHandle);
+
+/*!
+ * @brief Starts or tops up the receive stream.
+ *
+ * Queues every idle receive buffer on the MIDI IN pipe. Each completed transfer is split into its event packets,
+ * which go on the ring, and the buffer is queued again straight away. Buffers already queued are left alone, so
+ * this is also how the stream is primed again after an error.
+ *
+ * @param[in] classHandle   The class handle.
+ * @param[in] ring          Ring the received packets go on.
+ * @param[in] callbackFn    This callback is called after each receive transfer completes, may be NULL.
+ * @param[in] callbackParam The first parameter in the callback function.
+ *
+ * @retval kStatus_USB_Success        Receive request successfully.
+ * @retval kStatus_USB_InvalidHandle  The classHandle is NULL pointer.
+ * @retval kStatus_USB_Error          Pipe is not initialized, there is no idle transfer, or USB_HostRecv fail.
+ */
+extern usb_status_t USB_HostMidiStreamStart(usb_host_class_handle classHandle,
+                                            usb_host_midi_packet_ring_t *ring,
+                                            usb_host_midi_stream_callback_t callbackFn,
+                                            void *callbackParam);
+
+/*!
+ * @brief Stops the receive stream.
+ *
+ * Cancels the queued receive transfers. The stream callback is called for each with kStatus_USB_TransferCancel.
+ *
+ * @param[in] classHandle The class handle.
+ *
+ * @retval kStatus_USB_Success        Cancel successfully.
+ * @retval kStatus_USB_InvalidHandle  The classHandle is NULL pointer.
+ */
+extern usb_status_t USB_HostMidiStreamStop(usb_host_class_handle classHandle);
+
+/*!
+ * @brief Sends event packets.
+ *
+ * @param[in] classHandle   The class handle.
+ * @param[in] buffer        The event packets, a multiple of USB_HOST_MIDI_PACKET_SIZE bytes.
+ * @param[in] bufferLength  The buffer length.
+ * @param[in] callbackFn    This callback is called after this function completes.
+ * @param[in] callbackParam The first parameter in the callback function.
+ *
+ * @retval kStatus_USB_Success        Send request successfully.
+ * @retval kStatus_USB_InvalidHandle  The classHandle is NULL pointer.
+ * @retval kStatus_USB_Error          Pipe is not initialized, there is no idle transfer, or USB_HostSend fail.
+ */
+extern usb_status_t USB_HostMidiSend(usb_host_class_handle classHandle,
+                                     uint8_t *buffer,
+                                     uint32_t bufferLength,
+                                     transfer_callback_t callbackFn,
+                                     void *callbackParam);
+
+/*!
+ * @brief Gets the MIDI pipe maximum packet size.
+ *
+ * @param[in] classHandle The class handle.
+ * @param[in] direction   Pipe direction.
+ *
+ * @retval 0        The classHandle is NULL or the pipe is not open.
+ * @retval max packet size.
+ */
+extern uint16_t USB_HostMidiGetPacketsize(usb_host_class_handle classHandle, uint8_t direction);
+
+/*!
+ * @brief Gets the number of cables on a MIDI pipe.
+ *
+ * @param[in] classHandle The class handle.
+ * @param[in] direction   Pipe direction.
+ *
+ * @retval 0        The classHandle is NULL or the pipe is not open.
+ * @retval number of embedded jacks on the endpoint.
+ */
+extern uint8_t USB_HostMidiGetCableCount(usb_host_class_handle classHandle, uint8_t direction);
+
+/*!
+ * @brief Initializes a packet ring over the caller's storage.
+ *
+ * @param[in] ring       The ring.
+ * @param[in] packets    The packet storage.
+ * @param[in] timestamps The timestamp storage, the same size as the packet storage, or NULL.
+ * @param[in] size       The number of packets in the storage, a power of two.
+ * @param[in] clock      The clock received packets are timestamped from, or NULL.
+ */
+extern void USB_HostMidiRingInit(usb_host_midi_packet_ring_t *ring,
+                                 uint32_t *packets,
+                                 uint32_t *timestamps,
+                                 uint32_t size,
+                                 usb_host_midi_clock_t clock);
+
+/*!
+ * @brief Takes the oldest packet off a ring.
+ *
+ * Consumer side.
+ *
+ * @param[in] ring       The ring.
+ * @param[out] packet    The packet.
+ * @param[out] timestamp The packet's timestamp, may be NULL. 0 if the ring has no timestamps.
+ *
+ * @retval 1 A packet was taken.
+ * @retval 0 The ring is empty.
+ */
+extern uint8_t USB_HostMidiRingPop(usb_host_midi_packet_ring_t *ring, uint32_t *packet, uint32_t *timestamp);
+
+/*!
+ * @brief Gets the number of packets waiting on a ring.
+ *
+ * @param[in] ring The ring.
+ *
+ * @retval number of packets.
+ */
+extern uint32_t USB_HostMidiRingDepth(const usb_host_midi_packet_ring_t *ring);
+
+/*! @}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+/*! @}*/
+
+#endif /* __USB_HOST_MIDI_H__ */
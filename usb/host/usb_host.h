@@ -182,6 +182,7 @@ typedef struct _usb_host_pipe
     uint8_t direction;              /*!< Pipe direction*/
     uint8_t pipeType;               /*!< Pipe type, for example USB_ENDPOINT_BULK*/
     uint8_t numberPerUframe;        /*!< Transaction number per micro-frame*/
+    uint8_t noTimeout;              /*!< 1 - bulk in transfers wait for the device without timing out*/
 } usb_host_pipe_t;
 
 /*! @brief USB host transfer structure */
@@ -227,6 +228,7 @@ typedef struct _usb_host_pipe_init
     uint8_t pipeType;        /*!< Endpoint type, the value is USB_ENDPOINT_INTERRUPT, USB_ENDPOINT_CONTROL,
                                 USB_ENDPOINT_ISOCHRONOUS, USB_ENDPOINT_BULK*/
     uint8_t numberPerUframe; /*!< Transaction number for each micro-frame*/
+    uint8_t noTimeout;       /*!< 1 - bulk in transfers never time out, see USB_HOST_CONFIG_EHCI_BULK_IN_NO_TIMEOUT*/
 } usb_host_pipe_init_t;
 
 /*! @brief Cancel transfer parameter structure */
@@ -139,6 +139,15 @@
  */
 #define USB_HOST_CONFIG_EHCI_MAX_ITD (0)
 
+/*!
+ * @brief ehci bulk in pipes opened with noTimeout set never time out.
+ * their transfers stay queued until the device answers, for devices such as MIDI
+ * keyboards that NAK for as long as nothing is played. only the pipes that ask for
+ * it are affected, the MIDI class driver asks for its IN pipe; other bulk in pipes
+ * keep the 50 ms timeout.
+ */
+#define USB_HOST_CONFIG_EHCI_BULK_IN_NO_TIMEOUT (1U)
+
 /*!
  * @brief ehci SITD max count.
  */
@@ -214,7 +223,7 @@
  *        - if 0, host CDC class driver is disable.
  *        - if greater than 0, host CDC class driver is enable.
  */
-#define USB_HOST_CONFIG_CDC (1U)
+#define USB_HOST_CONFIG_CDC (0)
 
 /*!
  * @brief host AUDIO class instance count, meantime it indicates AUDIO class enable or disable.
@@ -223,6 +232,13 @@
  */
 #define USB_HOST_CONFIG_AUDIO (0)
 
+/*!
+ * @brief host MIDI class instance count, meantime it indicates MIDI class enable or disable.
+ *        - if 0, host MIDI class driver is disable.
+ *        - if greater than 0, host MIDI class driver is enable.
+ */
+#define USB_HOST_CONFIG_MIDI (1U)
+
 /*!
  * @brief host PHDC class instance count, meantime it indicates PHDC class enable or disable.
  *        - if 0, host PHDC class driver is disable.
@@ -1109,6 +1109,7 @@ usb_status_t USB_HostAttachDevice(usb_host_handle hostHandle,
     pipeInit.maxPacketSize   = 8;
     pipeInit.numberPerUframe = 0;
     pipeInit.nakCount        = USB_HOST_CONFIG_MAX_NAK;
+    pipeInit.noTimeout       = 0;
     if (USB_HostOpenPipe(hostHandle, &newInstance->controlPipe, &pipeInit) != kStatus_USB_Success)
     {
         /* don't need release resource, resource is released when detach */
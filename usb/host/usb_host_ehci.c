@@ -3887,6 +3887,14 @@ static void USB_HostEhciTimer0(usb_host_ehci_instance_t *ehciInstance)
                             (~EHCI_HOST_QTD_STATUS_MASK); /* clear error status */
                         timeoutLabel = 1;
                     }
+#if ((defined USB_HOST_CONFIG_EHCI_BULK_IN_NO_TIMEOUT) && (USB_HOST_CONFIG_EHCI_BULK_IN_NO_TIMEOUT))
+                    else if ((ehciPipePointer->pipeCommon.pipeType == USB_ENDPOINT_BULK) &&
+                             (ehciPipePointer->pipeCommon.direction == USB_IN) &&
+                             (ehciPipePointer->pipeCommon.noTimeout))
+                    {
+                        /* the pipe waits as long as the device has nothing to send, the controller retries the NAKs */
+                    }
+#endif
                     else
                     {
                         if (vltQhPointer->transferOverlayResults[0] & EHCI_HOST_QTD_STATUS_ACTIVE_MASK)
@@ -4328,6 +4336,7 @@ usb_status_t USB_HostEhciOpenPipe(usb_host_controller_handle controllerHandle,
     }
     ehciPipePointer->pipeCommon.nakCount   = pipeInit->nakCount;
     ehciPipePointer->pipeCommon.nextdata01 = 0;
+    ehciPipePointer->pipeCommon.noTimeout  = pipeInit->noTimeout;
     ehciPipePointer->ehciQh                = NULL;
     USB_HostHelperGetPeripheralInformation(ehciPipePointer->pipeCommon.deviceHandle, kUSB_HostGetDeviceSpeed, &speed);
     if ((ehciPipePointer->pipeCommon.pipeType == USB_ENDPOINT_ISOCHRONOUS) ||